@@ -1,54 +1,143 @@
 #include "eventpoller/eventpoller.h"
+#include "eventpoller/uring.h"
+#include "config/config.h"
 #include "log/logger.h"
 #include "util/macro.h"
 #include "util/hook.h"
+#include "socket/fdManager.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <linux/time_types.h>
+#include <pthread.h>
+#include <sched.h>
 #include <string.h>
 #include <unistd.h>
+#include <algorithm>
 #include <future>
 
 namespace sylar {
 
 static Logger::Ptr g_logger = Name_Logger("system");
 
-EventPoller::EventPoller(size_t threads, bool use_caller, const std::string& name) 
-    :Scheduler(threads, use_caller, name) {
-    m_epfd = epoll_create(5000);
-    Assert((m_epfd > 0));
+static ConfigVar<std::string>::ptr g_eventpoller_backend =
+    Config::Lookup<std::string>("eventpoller.backend", "epoll", "event backend: epoll or io_uring");
 
-    int rt = pipe(m_tickleFds);
-    Assert(!rt);
-    
-    epoll_event event;
-    memset(&event, 0, sizeof(epoll_event));
-    event.events = EPOLLIN | EPOLLET;
-    event.data.fd = m_tickleFds[0];
+static ConfigVar<bool>::ptr g_eventpoller_per_thread_loop =
+    Config::Lookup<bool>("eventpoller.per_thread_loop", false, "one epoll instance per worker thread");
+
+static ConfigVar<uint32_t>::ptr g_eventpoller_busy_poll_us =
+    Config::Lookup<uint32_t>("eventpoller.busy_poll_us", 0, "max busy-poll window before blocking in epoll_wait, 0 disables");
+
+static ConfigVar<bool>::ptr g_eventpoller_io_affinity =
+    Config::Lookup<bool>("eventpoller.io_affinity", false, "resume fibers woken by io readiness on the thread that waited");
+
+static ConfigVar<uint32_t>::ptr g_eventpoller_io_affinity_max_load =
+    Config::Lookup<uint32_t>("eventpoller.io_affinity_max_load", 90, "load percent of the waiting thread above which the wakeup migrates");
+
+static ConfigVar<uint32_t>::ptr g_eventpoller_max_events =
+    Config::Lookup<uint32_t>("eventpoller.max_events", 256, "max events fetched by one epoll_wait, the batch adapts below it");
+
+// 内核默认给线程的定时睡眠留 50us 的松弛, 会吃掉微秒级定时器的精度。
+// 相近定时器的合并已由 TimerManager 按 timer.slack_ms 在时间轮里完成, 算出的等待时长就是合并后的唤醒点;
+// 内核松弛若再叠加在上面只会让唤醒额外推迟, 所以工作线程上设得很小
+static ConfigVar<uint32_t>::ptr g_eventpoller_timer_slack_ns =
+    Config::Lookup<uint32_t>("eventpoller.timer_slack_ns", 1, "kernel timer slack of threads spawned by the poller, 0 keeps the inherited value");
+
+static ConfigVar<uint32_t>::ptr g_eventpoller_uring_entries =
+    Config::Lookup<uint32_t>("eventpoller.uring_entries", 1024, "io_uring submission queue size");
+
+// io_uring 请求的 user_data: 0 表示无需处理(tickle、链接的超时、取消请求),
+// 否则低两位为标记, 其余为对象地址
+static constexpr uint64_t URING_TAG_MASK  = 3;
+static constexpr uint64_t URING_TAG_READ  = 1;
+static constexpr uint64_t URING_TAG_WRITE = 2;
+static constexpr uint64_t URING_TAG_IO    = 3;
+// signalfd 的 POLL_ADD: 标记位为0, 值不是任何对象的地址
+static constexpr uint64_t URING_SIGNAL    = URING_TAG_MASK + 1;
+
+// 完成模式的一次 IO, 位于发起协程的栈上, 完成时由 idle 线程写入结果并唤醒协程
+struct IoRequest {
+    Scheduler* scheduler = nullptr;
+    int thread = -1;
+    Fiber::Ptr fiber;
+    void* fd_ctx = nullptr;
+    int res = 0;
+};
+
+static std::atomic<uint64_t> s_eventpoller_id = {0};
+
+EventPoller::EventPoller(size_t threads, bool use_caller, const std::string& name, Backend backend)
+    :Scheduler(threads, use_caller, name)
+    ,m_id(++s_eventpoller_id) {
+    sigemptyset(&m_signalMask);
+    m_signalApplied.reset(new std::atomic<uint32_t>[getWorkerCount()]);
+    for(size_t i = 0; i < getWorkerCount(); ++i) {
+        m_signalApplied[i] = 0;
+    }
+    m_ioAffinity = g_eventpoller_io_affinity->getValue();
+    m_ioAffinityMaxLoad = g_eventpoller_io_affinity_max_load->getValue();
+    // 负载只在需要判断是否迁移时记录, 进出 idle 时有额外开销
+    setWorkerLoadTracking(m_ioAffinity);
+    m_timerShardBase = use_caller && getWorkerCount() > 1 ? 1 : 0;
+    setTimerShards(getWorkerCount() - m_timerShardBase);
+    if(backend == DEFAULT) {
+        backend = g_eventpoller_backend->getValue() == "io_uring" ? IO_URING : EPOLL;
+    }
+    if(backend == IO_URING) {
+        m_uring.reset(new IoUring);
+        if(m_uring->init(g_eventpoller_uring_entries->getValue())) {
+            m_backend = IO_URING;
+            m_loops.emplace_back(new Loop);
+            start();
+            return;
+        }
+        Log_Warn(g_logger) << "io_uring unavailable, fall back to epoll";
+        m_uring.reset();
+    }
 
-    rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
-    Assert(!rt);
+    // 每线程模式下 Loop 与工作线程一一对应
+    size_t loops = g_eventpoller_per_thread_loop->getValue() ? getWorkerCount() : 1;
+    for(size_t i = 0; i < loops; ++i) {
+        std::unique_ptr<Loop> loop(new Loop);
+        loop->epfd = epoll_create(5000);
+        Assert((loop->epfd > 0));
 
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-    Assert(!rt);
+        // eventfd 的计数在读之前一直可读, 多次写入只需一次读
+        loop->tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        Assert((loop->tickleFd >= 0));
+
+        epoll_event event;
+        memset(&event, 0, sizeof(epoll_event));
+        event.events = EPOLLIN | EPOLLET;
+        event.data.fd = loop->tickleFd;
+
+        int rt = epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->tickleFd, &event);
+        Assert(!rt);
+        m_loops.emplace_back(std::move(loop));
+    }
 
-    contextResize(32);
-    
     start();
 }
 
 EventPoller::~EventPoller() {
     stop();
-    close(m_epfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
-
-    for(size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if(m_fdContexts[i]) {
-            delete m_fdContexts[i];
+    m_uring.reset();
+    for(auto& i : m_loops) {
+        if(i->epfd >= 0) {
+            close(i->epfd);
+            close(i->tickleFd);
         }
     }
+    if(m_signalFd >= 0) {
+        close(m_signalFd);
+    }
     Log_Debug(g_logger) << "~EventPoller()";
 }
 
@@ -57,43 +146,47 @@ EventPoller* EventPoller::getThis() {
 }
 
 bool EventPoller::stopping(uint64_t &timeout) {
-    timeout = getNextTimer();
+    timeout = getNextTimerUs();
+    // 定时器分散在各线程的分片中, 任何一个还有定时器都不能退出
     return m_pendingEventCount == 0
-        && timeout == ~0ull
+        && !hasTimer()
         && Scheduler::stopping();
 
 }
 
 bool EventPoller::stopping() {
     uint64_t timeout = 0;
-    stopping(timeout);
+    return stopping(timeout);
 }
 
-void EventPoller::contextResize(size_t size) {
-    // writeLock(m_mtx);
-    std::unique_lock<MutexType> lock(m_mtx);
-    if(size <= m_fdContexts.size())  {
-        return;
-    }
-    m_fdContexts.resize(size);
-    for(int i = 0; i < size; ++i) {
-        if(!m_fdContexts[i]) {
-            m_fdContexts[i] = new FdContext;
-            m_fdContexts[i]->fd = i;
-        }
+void EventPoller::FdContext::triggerEvent(Event event, int thread) {
+    Assert((events & event));
+
+    events = (Event)(events & ~event);
+    EventContext& ctx = getContext(event);
+    if(ctx.cb) {
+        ctx.scheduler->schedule(&ctx.cb, thread);
+    } 
+    else {
+        ctx.scheduler->schedule(&ctx.fiber, thread);
     }
+    ctx.scheduler = nullptr;
 }
 
-void EventPoller::FdContext::triggerEvent(Event event) {
+void EventPoller::FdContext::triggerEvent(Event event, int thread, Scheduler* owner, std::vector<FiberTask>& batch) {
+    EventContext& ctx = getContext(event);
+    if(ctx.scheduler != owner) {
+        triggerEvent(event, thread);
+        return;
+    }
     Assert((events & event));
 
     events = (Event)(events & ~event);
-    EventContext& ctx = getContext(event);
     if(ctx.cb) {
-        ctx.scheduler->schedule(&ctx.cb);
-    } 
+        batch.emplace_back(&ctx.cb, thread);
+    }
     else {
-        ctx.scheduler->schedule(&ctx.fiber);
+        batch.emplace_back(&ctx.fiber, thread);
     }
     ctx.scheduler = nullptr;
 }
@@ -112,21 +205,204 @@ EventPoller::FdContext::EventContext& EventPoller::FdContext::getContext(EventPo
 
 void EventPoller::FdContext::resetContext(EventContext& ctx) {
     ctx.scheduler = nullptr;
+    ctx.thread = -1;
     ctx.fiber.reset();
     ctx.cb = nullptr;
 }
 
+EventPoller::FdContext* EventPoller::getFdContext(int fd, bool create) {
+    FdCtx* record = FdMgr::getInstance()->getRecord(fd, create);
+    return record ? &record->m_event : nullptr;
+}
+
+template<class F>
+bool EventPoller::uringSubmit(F prep, bool force) {
+    {
+        std::lock_guard<std::mutex> lock(m_uring->sqMutex());
+        if(!prep()) {
+            m_uring->discardNonLock();
+            return false;
+        }
+        m_uring->commitNonLock();
+    }
+    // commitNonLock 之后有全屏障: 这里看不到睡眠的线程时, 之后登记睡眠的线程一定能看到这个 SQE
+    if(force || m_loops[0]->sleeping > 0) {
+        if(m_uring->submit() < 0) {
+            Log_Error(g_logger) << "io_uring submit errno=" << errno << " " << strerror(errno);
+        }
+    }
+    return true;
+}
+
+bool EventPoller::addSignalHandler(int signo, std::function<void()> cb) {
+    if(signo <= 0 || signo >= NSIG || signo == SIGKILL || signo == SIGSTOP) {
+        return false;
+    }
+    sigset_t one;
+    sigemptyset(&one);
+    sigaddset(&one, signo);
+
+    // 调用线程立即屏蔽; 工作线程在下一轮 idle 开头按版本号补上, 不为此挂起或阻塞任何工作线程
+    pthread_sigmask(SIG_BLOCK, &one, nullptr);
+
+    std::unique_lock<std::mutex> lock(m_signalMtx);
+    sigset_t mask = m_signalMask;
+    sigaddset(&mask, signo);
+    int fd = m_signalFd;
+    // 已有 signalfd 时只更新信号集, flags 被忽略
+    int rt = signalfd(fd, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(rt < 0) {
+        Log_Error(g_logger) << "signalfd(" << fd << ", " << signo << ") errno=" << errno
+            << " " << strerror(errno);
+        return false;
+    }
+    m_signalMask = mask;
+    m_signalHandlers[signo] = std::move(cb);
+    if(fd < 0 && !registerSignalFd(rt)) {
+        return false;
+    }
+
+    uint32_t gen = ++m_signalGen;
+    // 唤醒睡眠中的工作线程来屏蔽
+    for(size_t i = 0; i < m_loops.size(); ++i) {
+        tickleLoop(i);
+    }
+    // 不是工作线程的调用方可以阻塞, 等所有工作线程都已屏蔽, 返回后信号不会按原处理方式投递给它们;
+    // 共享 Loop 上被唤醒的线程接力唤醒其余线程, 见 syncSignalMask
+    if(!getCurrentWorker()) {
+        m_signalCond.wait(lock, [this, gen]() { return signalMaskApplied(gen); });
+    }
+    return true;
+}
+
+bool EventPoller::registerSignalFd(int fd) {
+    m_signalFd = fd;
+    if(m_uring) {
+        armSignalUring();
+        return true;
+    }
+    // 与 tickle 的 eventfd 一样由 data.fd 识别; 每线程模式下固定在一个创建出的工作线程的 Loop 上,
+    // 与定时器分片一样避开只在 stop 时才轮询的根线程
+    size_t idx = isPerThreadLoop() ? m_timerShardBase : 0;
+    epoll_event event;
+    memset(&event, 0, sizeof(epoll_event));
+    event.events = EPOLLIN | EPOLLET;
+    event.data.fd = fd;
+    if(epoll_ctl(m_loops[idx]->epfd, EPOLL_CTL_ADD, fd, &event)) {
+        Log_Error(g_logger) << "epoll_ctl add signalfd errno=" << errno << " " << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+void EventPoller::onThreadStart() {
+    // 只改本调度器创建的线程, use_caller 的根线程是调用方的线程, 保持原样
+    uint32_t slack = g_eventpoller_timer_slack_ns->getValue();
+    if(slack) {
+        prctl(PR_SET_TIMERSLACK, (unsigned long)slack);
+    }
+    // 启动之后才登记的信号由 syncSignalMask 补上
+    std::lock_guard<std::mutex> lock(m_signalMtx);
+    pthread_sigmask(SIG_BLOCK, &m_signalMask, nullptr);
+}
+
+void EventPoller::syncSignalMask() {
+    Worker* self = getCurrentWorker();
+    uint32_t gen = m_signalGen.load(std::memory_order_acquire);
+    if(!self || m_signalApplied[self->index].load(std::memory_order_relaxed) == gen) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_signalMtx);
+        pthread_sigmask(SIG_BLOCK, &m_signalMask, nullptr);
+        m_signalApplied[self->index] = m_signalGen.load(std::memory_order_relaxed);
+    }
+    m_signalCond.notify_all();
+    if(isPerThreadLoop()) {
+        return;
+    }
+    // 共享 Loop 上一次 tickle 只唤醒最后进入等待的线程; 本线程接力唤醒其余线程,
+    // 并在对方读走唤醒之前不回去等待, 否则会被自己抢走。没有线程在睡眠时停止
+    Loop* loop = m_loops[0].get();
+    for(int i = 0; i < 64 && !signalMaskApplied(gen); ++i) {
+        if(!tickleLoop(0)) {
+            break;
+        }
+        for(int spin = 0; spin < 10000 && loop->notified; ++spin) {
+            sched_yield();
+        }
+    }
+}
+
+bool EventPoller::signalMaskApplied(uint32_t gen) {
+    for(size_t i = 0; i < getWorkerCount(); ++i) {
+        Worker* worker = getWorkerAt(i);
+        // 根线程只在 stop 时才进入调度循环, 不等它
+        if(worker->thread_id == -1 || worker->thread_id == getRootThread()) {
+            continue;
+        }
+        if((int32_t)(m_signalApplied[i].load(std::memory_order_relaxed) - gen) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void EventPoller::readSignals(std::vector<FiberTask>& batch) {
+    signalfd_siginfo infos[16];
+    while(true) {
+        ssize_t n = read(m_signalFd, infos, sizeof(infos));
+        if(n <= 0) {
+            if(n < 0 && errno != EAGAIN && errno != EINTR) {
+                Log_Error(g_logger) << "read signalfd errno=" << errno << " " << strerror(errno);
+            }
+            break;
+        }
+        std::lock_guard<std::mutex> lock(m_signalMtx);
+        for(size_t i = 0; i < n / sizeof(signalfd_siginfo); ++i) {
+            auto it = m_signalHandlers.find(infos[i].ssi_signo);
+            if(it != m_signalHandlers.end() && it->second) {
+                batch.emplace_back(it->second, -1);
+            }
+        }
+    }
+}
+
+void EventPoller::armSignalUring() {
+    int fd = m_signalFd;
+    uringSubmit([this, fd]() {
+        io_uring_sqe* sqe = m_uring->getSqeNonLock();
+        if(!sqe) {
+            return false;
+        }
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = URING_SIGNAL;
+        return true;
+    }, true);
+}
+
+void EventPoller::uringCancelPoll(FdContext* fd_ctx, Event event) {
+    // 被取消的 POLL_ADD 以 -ECANCELED 完成, 那时事件位已清除, 完成会被忽略
+    uint64_t key = (uint64_t)(uintptr_t)fd_ctx | (event == READ ? URING_TAG_READ : URING_TAG_WRITE);
+    uringSubmit([this, key]() {
+        io_uring_sqe* sqe = m_uring->getSqeNonLock();
+        if(!sqe) {
+            return false;
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = key;
+        return true;
+    }, false);
+}
+
 int EventPoller::addEvent(int fd, Event event, std::function<void()> cb) {
-    FdContext* fd_ctx = nullptr;
-    std::shared_lock<MutexType> readlock(m_mtx);
-    if((int)m_fdContexts.size() > fd) {
-        fd_ctx = m_fdContexts[fd];
-        readlock.unlock();
-    } else {
-        readlock.unlock();
-        std::unique_lock<MutexType> writelock(m_mtx);
-        contextResize(fd * 1.5);
-        fd_ctx = m_fdContexts[fd];
+    FdContext* fd_ctx = getFdContext(fd, true);
+    if(!fd_ctx) {
+        Log_Error(g_logger) << "addEvent fd=" << fd << " out of range";
+        return -1;
     }
 
     std::lock_guard<FdContext::MutexType> fd_lock(fd_ctx->mutex);
@@ -137,18 +413,62 @@ int EventPoller::addEvent(int fd, Event event, std::function<void()> cb) {
         Assert(!(fd_ctx->events & event));
     }
 
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epevent;
-    epevent.events = EPOLLET | fd_ctx->events | event;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        Log_Error(g_logger) << "epoll_ctl(" << m_epfd << ", "
-            << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-            << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
-            << (EPOLL_EVENTS)fd_ctx->events;
-        return -1;
+    if(m_uring) {
+        // 读写各自是一个单次的 POLL_ADD, 互不影响, 不需要 MOD
+        bool ok = uringSubmit([this, fd, fd_ctx, event]() {
+            io_uring_sqe* sqe = m_uring->getSqeNonLock();
+            if(!sqe) {
+                return false;
+            }
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = fd;
+            sqe->poll32_events = event == READ ? POLLIN : POLLOUT;
+            sqe->user_data = (uint64_t)(uintptr_t)fd_ctx | (event == READ ? URING_TAG_READ : URING_TAG_WRITE);
+            return true;
+        }, false);
+        if(!ok) {
+            return -1;
+        }
+        fd_ctx->owner = m_id;
+    } else {
+        // 等待者登记之前到达的边沿: 协程直接交给调用方重试, 不必挂起; 回调立即调度
+        if(fd_ctx->ready & event) {
+            fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+            if(!cb) {
+                return 1;
+            }
+            Scheduler* scheduler = Scheduler::getThis() ? Scheduler::getThis() : this;
+            scheduler->schedule(std::move(cb), getCurrentWorker() ? getThreadId() : -1);
+            return 0;
+        }
+        if(!fd_ctx->registered || fd_ctx->owner != m_id) {
+            // 常驻注册读写两个方向, 之后等待与触发都不再修改 epoll;
+            // ADD 时内核会按当前状态补报一次边沿, 注册前已就绪的事件不会丢失
+            size_t loop = selectLoop();
+            int epfd = m_loops[loop]->epfd;
+            epoll_event epevent;
+            epevent.events = EPOLLIN | EPOLLOUT | EPOLLET;
+            epevent.data.ptr = fd_ctx;
+            int op = EPOLL_CTL_ADD;
+            int rt = epoll_ctl(epfd, op, fd, &epevent);
+            if(rt && errno == EEXIST) {
+                // cancelAll 之后 fd 没有关闭, 仍在 epoll 中
+                op = EPOLL_CTL_MOD;
+                rt = epoll_ctl(epfd, op, fd, &epevent);
+            }
+            if(rt) {
+                Log_Error(g_logger) << "epoll_ctl(" << epfd << ", "
+                    << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                    << rt << " (" << errno << ") (" << strerror(errno) << ")";
+                return -1;
+            }
+            if(fd_ctx->owner != m_id) {
+                fd_ctx->owner = m_id;
+                fd_ctx->ready = NONE;
+            }
+            fd_ctx->registered = true;
+            fd_ctx->loop = loop;
+        }
     }
 
     ++m_pendingEventCount;
@@ -158,7 +478,9 @@ int EventPoller::addEvent(int fd, Event event, std::function<void()> cb) {
                 && !event_ctx.fiber
                 && !event_ctx.cb));
 
-    event_ctx.scheduler = Scheduler::getThis();
+    // 调度器之外的线程登记的回调由本调度器执行
+    event_ctx.scheduler = Scheduler::getThis() ? Scheduler::getThis() : this;
+    event_ctx.thread = getCurrentWorker() ? getThreadId() : -1;
     if(cb) {
         event_ctx.cb.swap(cb);
     } else {
@@ -169,30 +491,20 @@ int EventPoller::addEvent(int fd, Event event, std::function<void()> cb) {
 }
 
 bool EventPoller::delEvent(int fd, Event event) {
-    //readLock(m_mtx);
-    std::shared_lock<MutexType> lock(m_mtx);
-    if((int)m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    m_mtx.unlock_shared();
-    
+
     std::lock_guard<std::mutex> lokc(fd_ctx->mutex);
-    if(!(fd_ctx->events & event)) {
+    if(fd_ctx->owner != m_id || !(fd_ctx->events & event)) {
         return false;
     }
 
+    // epoll 的注册是常驻的, 只需清除等待者
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        Log_Error(g_logger) << "epoll_ctl(" << m_epfd << ", "
-            << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-            << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+    if(m_uring) {
+        uringCancelPoll(fd_ctx, event);
     }
 
     --m_pendingEventCount;
@@ -203,32 +515,18 @@ bool EventPoller::delEvent(int fd, Event event) {
 }
 
 bool EventPoller::cancelEvent(int fd, Event event) {
-    // readLock(m_mtx);
-    std::shared_lock<MutexType> lock(m_mtx);
-    if((int)m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    // readUnLock(m_mtx);
-    m_mtx.unlock_shared();
-    
+
     std::lock_guard<std::mutex> lokc(fd_ctx->mutex);
-    if(!(fd_ctx->events & event)) {
+    if(fd_ctx->owner != m_id || !(fd_ctx->events & event)) {
         return false;
     }
 
-    Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        Log_Error(g_logger) << "epoll_ctl(" << m_epfd << ", "
-            << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-            << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+    if(m_uring) {
+        uringCancelPoll(fd_ctx, event);
     }
 
     --m_pendingEventCount;
@@ -237,31 +535,34 @@ bool EventPoller::cancelEvent(int fd, Event event) {
 }
 
 bool EventPoller::cancelAll(int fd) {
-    //readLock(m_mtx);
-    std::shared_lock<MutexType> lock(m_mtx);
-    if((int)m_fdContexts.size() <= fd) {
-        return false;
-    }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    // readUnLock(m_mtx);
-    m_mtx.unlock_shared();
-    
-    std::lock_guard<std::mutex> lokc(fd_ctx->mutex);
-    if(!(fd_ctx->events)) {
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) {
         return false;
     }
 
-    int op = EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = 0;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        Log_Error(g_logger) << "epoll_ctl(" << m_epfd << ", "
-            << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-            << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+    std::lock_guard<std::mutex> lokc(fd_ctx->mutex);
+    if(m_uring) {
+        if(fd_ctx->owner != m_id || (!fd_ctx->events && !fd_ctx->asyncOps)) {
+            return false;
+        }
+        // 内核持有文件的引用, close 不会结束在途的请求, 必须在 close 之前同步提交取消
+        ++fd_ctx->cancelSeq;
+        uringSubmit([this, fd]() {
+            io_uring_sqe* sqe = m_uring->getSqeNonLock();
+            if(!sqe) {
+                return false;
+            }
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = fd;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+            return true;
+        }, true);
+    } else {
+        // 只触发等待者, 常驻注册保持不变: fd 可能不会随后关闭(被 dup 或只是取消等待),
+        // 清掉后下次等待会在别的 Loop 上重复注册; 关闭时由 FdManager::del 作废注册状态
+        if(fd_ctx->owner != m_id || !(fd_ctx->events)) {
+            return false;
+        }
     }
 
     if(fd_ctx->events & READ) {
@@ -278,60 +579,429 @@ bool EventPoller::cancelAll(int fd) {
 }
 
 void EventPoller::tickle() {
-    int rt = write(m_tickleFds[1], "T", 1);
-    Assert((rt == 1));
+    // 与 prepareSleep 中登记睡眠后的复查配对: 这里看不到睡眠的线程时, 它一定能看到刚投递的任务
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool issued = false;
+    if(!isPerThreadLoop()) {
+        issued = tickleLoop(0);
+    } else {
+        // 每线程模式下只唤醒需要醒的线程: 先是收件箱里有任务的线程, 否则轮流选一个在睡眠的线程
+        Worker* self = getCurrentWorker();
+        for(size_t i = 0; i < m_loops.size(); ++i) {
+            Worker* worker = getWorkerAt(i);
+            if(worker != self && !worker->inbox.empty()) {
+                issued = tickleLoop(i) || issued;
+            }
+        }
+        size_t start = m_nextLoop++;
+        for(size_t i = 0; !issued && i < m_loops.size(); ++i) {
+            size_t idx = (start + i) % m_loops.size();
+            if(getWorkerAt(idx) != self) {
+                issued = tickleLoop(idx);
+            }
+        }
+    }
+    if(issued) {
+        m_tickleIssued.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        m_tickleSuppressed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool EventPoller::tickleLoop(size_t idx) {
+    Loop* loop = m_loops[idx].get();
+    if(loop->sleeping == 0 || loop->notified.exchange(true)) {
+        return false;
+    }
+    if(m_uring) {
+        // 一个空操作的完成就能唤醒等在 io_uring_enter 里的线程
+        uringSubmit([this]() {
+            io_uring_sqe* sqe = m_uring->getSqeNonLock();
+            if(!sqe) {
+                return false;
+            }
+            sqe->opcode = IORING_OP_NOP;
+            return true;
+        }, true);
+        return true;
+    }
+    uint64_t one = 1;
+    int rt = write(loop->tickleFd, &one, sizeof(one));
+    Assert((rt == sizeof(one) || errno == EAGAIN));
+    return true;
+}
+
+uint64_t EventPoller::prepareSleep(Loop* loop) {
+    ++loop->sleeping;
+    if(hasPendingTask()) {
+        return 0;
+    }
+    // 与 addSignalHandler 中递增版本号后的 tickle 配对: 没被唤醒的线程在这里看到新版本
+    Worker* self = getCurrentWorker();
+    if(self && m_signalApplied[self->index].load(std::memory_order_relaxed) != m_signalGen.load()) {
+        return 0;
+    }
+    // 登记之后再取最近的定时器, 之前插入到最前面的定时器不会因为 tickle 被省掉而错过
+    uint64_t timeout = getNextTimerUs();
+    return timeout > MAX_TIMEOUT ? MAX_TIMEOUT : timeout;
+}
+
+// 以微秒精度等待: 优先用 epoll_pwait2, 内核不支持时退回 epoll_wait, 超时向上取整到毫秒, 只会晚醒不会早醒
+static int EpollWaitUs(int epfd, epoll_event* events, int max_events, uint64_t timeout_us) {
+#ifdef SYS_epoll_pwait2
+    static std::atomic<bool> s_no_pwait2 = {false};
+    if(!s_no_pwait2.load(std::memory_order_relaxed)) {
+        __kernel_timespec ts;
+        ts.tv_sec = timeout_us / 1000000;
+        ts.tv_nsec = (timeout_us % 1000000) * 1000;
+        int rt = syscall(SYS_epoll_pwait2, epfd, events, max_events, &ts, nullptr, 0);
+        if(rt >= 0 || errno != ENOSYS) {
+            return rt;
+        }
+        s_no_pwait2.store(true, std::memory_order_relaxed);
+    }
+#endif
+    return epoll_wait(epfd, events, max_events, int((timeout_us + 999) / 1000));
+}
+
+size_t EventPoller::selectLoop() {
+    if(!isPerThreadLoop()) {
+        return 0;
+    }
+    Worker* self = getCurrentWorker();
+    if(self) {
+        return self->index;
+    }
+    // 与定时器分片一样, 有其他线程时不分给只在 stop 时才轮询的根线程
+    return m_timerShardBase + m_nextLoop++ % (m_loops.size() - m_timerShardBase);
+}
+
+ssize_t EventPoller::asyncIo(int op, int fd, void* addr, uint32_t len, int flags, uint64_t timeout_ms) {
+    Fiber::Ptr cur = m_uring ? Fiber::getThis() : nullptr;
+    // 共享栈协程切出后栈地址会被别的协程使用, 内核不能在那时读写其中的缓冲区
+    if(!cur || cur.get() == Scheduler::getMainFiber() || cur->isSharedStack()) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    FdContext* fd_ctx = getFdContext(fd, true);
+    if(!fd_ctx) {
+        errno = EBADF;
+        return -1;
+    }
+    uint32_t cancel_seq;
+    {
+        std::lock_guard<FdContext::MutexType> lock(fd_ctx->mutex);
+        ++fd_ctx->asyncOps;
+        fd_ctx->owner = m_id;
+        cancel_seq = fd_ctx->cancelSeq;
+    }
+    ++m_pendingEventCount;
+
+    IoRequest req;
+    req.scheduler = Scheduler::getThis();
+    req.thread = getCurrentWorker() ? getThreadId() : -1;
+    req.fiber = std::move(cur);
+    req.fd_ctx = fd_ctx;
+
+    __kernel_timespec ts;
+    bool ok = uringSubmit([&]() {
+        io_uring_sqe* sqe = m_uring->getSqeNonLock();
+        io_uring_sqe* link = nullptr;
+        if(!sqe || (timeout_ms != ~0ull && !(link = m_uring->getSqeNonLock()))) {
+            return false;
+        }
+        sqe->opcode = op;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)addr;
+        sqe->len = len;
+        sqe->msg_flags = flags;
+        sqe->user_data = (uint64_t)(uintptr_t)&req | URING_TAG_IO;
+        if(link) {
+            // 超时由内核处理: 到期时取消前一个请求, 它以 -ECANCELED 完成
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (timeout_ms % 1000) * 1000 * 1000;
+            sqe->flags |= IOSQE_IO_LINK;
+            link->opcode = IORING_OP_LINK_TIMEOUT;
+            link->fd = -1;
+            link->addr = (uint64_t)(uintptr_t)&ts;
+            link->len = 1;
+        }
+        return true;
+    }, false);
+
+    if(!ok) {
+        std::lock_guard<FdContext::MutexType> lock(fd_ctx->mutex);
+        --fd_ctx->asyncOps;
+        --m_pendingEventCount;
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    // 完成时 handleCqe 填入 req.res 并重新调度本协程
+    Fiber::yieldToHold();
+
+    if(req.res >= 0) {
+        return req.res;
+    }
+    if(req.res == -ECANCELED) {
+        std::lock_guard<FdContext::MutexType> lock(fd_ctx->mutex);
+        setErrno(fd_ctx->cancelSeq != cancel_seq ? EBADF : ETIMEDOUT);
+        return -1;
+    }
+    setErrno(-req.res);
+    return -1;
+}
+
+size_t EventPoller::handleCqe(const io_uring_cqe& cqe, std::vector<FiberTask>& batch) {
+    if(cqe.user_data == URING_SIGNAL) {
+        readSignals(batch);
+        armSignalUring();
+        return 0;
+    }
+    uint64_t tag = cqe.user_data & URING_TAG_MASK;
+    void* ptr = (void*)(uintptr_t)(cqe.user_data & ~URING_TAG_MASK);
+    if(!ptr) {
+        return 0;
+    }
+
+    if(tag == URING_TAG_IO) {
+        IoRequest* req = (IoRequest*)ptr;
+        FdContext* fd_ctx = (FdContext*)req->fd_ctx;
+        {
+            std::lock_guard<FdContext::MutexType> lock(fd_ctx->mutex);
+            --fd_ctx->asyncOps;
+        }
+        // 调度之后 req 随时可能随协程返回而失效
+        Scheduler* scheduler = req->scheduler;
+        Fiber::Ptr fiber = std::move(req->fiber);
+        req->res = cqe.res;
+        if(scheduler == this) {
+            batch.emplace_back(&fiber, resumeThread(req->thread, -1));
+        }
+        else {
+            scheduler->schedule(std::move(fiber));
+        }
+        return 1;
+    }
+
+    FdContext* fd_ctx = (FdContext*)ptr;
+    Event event = tag == URING_TAG_READ ? READ : WRITE;
+    std::lock_guard<FdContext::MutexType> lock(fd_ctx->mutex);
+    // 已被 delEvent/cancelEvent/cancelAll 处理过的请求不再触发
+    if(fd_ctx->owner == m_id && (fd_ctx->events & event)) {
+        FdContext::EventContext& ctx = fd_ctx->getContext(event);
+        fd_ctx->triggerEvent(event, ctx.scheduler == this ? resumeThread(ctx.thread, -1) : -1, this, batch);
+        return 1;
+    }
+    return 0;
+}
+
+int EventPoller::resumeThread(int waiter, int fallback) {
+    if(!m_ioAffinity || waiter == -1) {
+        return fallback;
+    }
+    // 分发事件的线程正空闲, 不必看负载
+    int load = waiter == getThreadId() ? 0 : getWorkerLoad(waiter);
+    if(load < 0) {
+        // 登记的线程已经不在
+        return fallback;
+    }
+    if(load >= m_ioAffinityMaxLoad) {
+        ++m_ioMigrated;
+        return -1;
+    }
+    ++m_ioPinned;
+    return waiter;
+}
+
+bool EventPoller::busyPoll(Loop* loop, epoll_event* events, int max_events, uint64_t spin_us, int& rt) {
+    // 任务队列每轮都看, epoll_wait(0) 每隔几微秒才调用一次, 避免忙等本身变成系统调用风暴
+    static const uint64_t s_poll_interval_us = 5;
+    uint64_t now = getTimeUsec();
+    uint64_t deadline = now + spin_us;
+    uint64_t next_poll = now;
+    while(true) {
+        if(now >= next_poll) {
+            rt = epoll_wait(loop->epfd, events, max_events, 0);
+            if(rt > 0) {
+                return true;
+            }
+            next_poll = now + s_poll_interval_us;
+        }
+        if(hasPendingTask()) {
+            rt = 0;
+            return true;
+        }
+        if(now >= deadline) {
+            break;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+        now = getTimeUsec();
+    }
+    rt = 0;
+    return false;
+}
+
+void EventPoller::idleUring() {
+    const unsigned MAX_CQES = 256;
+    std::unique_ptr<io_uring_cqe[]> cqes(new io_uring_cqe[MAX_CQES]);
+    std::vector<FiberTask> batch;
+    batch.reserve(MAX_CQES);
+    std::vector<Func> cbs;
+
+    while(true) {
+        syncSignalMask();
+        uint64_t next_timeout;
+        if(stopping(next_timeout)) {
+            tickle();
+            break;
+        }
+        // 一次 io_uring_enter 同时提交积攒的 SQE 并等待完成
+        Loop* loop = m_loops[0].get();
+        next_timeout = prepareSleep(loop);
+        int rt = m_uring->wait(next_timeout);
+        --loop->sleeping;
+        loop->notified = false;
+        if(rt < 0) {
+            Log_Error(g_logger) << "io_uring wait errno=" << errno << " " << strerror(errno);
+        }
+
+        // 到期定时器与完成事件攒成一批, 一次投递
+        listExpiredCb(cbs);
+        for(auto& cb : cbs) {
+            batch.emplace_back(&cb, -1);
+        }
+        cbs.clear();
+
+        unsigned n;
+        size_t fired = 0;
+        while((n = m_uring->reap(cqes.get(), MAX_CQES)) > 0) {
+            for(unsigned i = 0; i < n; ++i) {
+                fired += handleCqe(cqes[i], batch);
+            }
+        }
+        scheduleBatch(batch);
+        m_pendingEventCount -= fired;
+
+        Fiber::Ptr cur = Fiber::getThis();
+        auto raw_ptr = cur.get();
+        cur.reset();
+
+        raw_ptr->swapOut();
+    }
 }
 
 void EventPoller::idle() {
-    const uint64_t MAX_EVNETS = 256;
-    epoll_event* events = new epoll_event[MAX_EVNETS]();
+    if(m_uring) {
+        idleUring();
+        return;
+    }
+    Loop* loop = m_loops[selectLoop()].get();
+    // 每线程模式下就绪的协程回到本线程执行, 连接的整个生命周期都留在这个 Loop 上
+    int owner = isPerThreadLoop() ? getThreadId() : -1;
+    // 单次取回的事件数在 [MIN_EVENTS, max_events] 之间自适应: 取满说明积压, 翻倍;
+    // 连续多次不到四分之一时减半, 共享模式下把剩余事件留给其他线程
+    const int MIN_EVENTS = 16;
+    const int max_events = std::max<int>(g_eventpoller_max_events->getValue(), MIN_EVENTS);
+    int batch_events = std::min(64, max_events);
+    int shrink_votes = 0;
+    epoll_event* events = new epoll_event[max_events]();
     std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr){
         delete[] ptr;
     });
+    std::vector<FiberTask> batch;
+    batch.reserve(max_events);
+    std::vector<Func> cbs;
 
+    // 忙等窗口按本线程最近的事件间隔自适应: 间隔的滑动平均在最大窗口以内才忙等, 窗口取平均间隔的两倍;
+    // 进程空闲时间隔变大, 自然退回阻塞等待
+    const uint64_t max_spin_us = g_eventpoller_busy_poll_us->getValue();
+    uint64_t avg_gap_us = max_spin_us + 1;
     int rt = 0;
     while(true) {
+        syncSignalMask();
         uint64_t next_timeout;
         if(stopping(next_timeout)) {
+            // 连续的 tickle 可能只唤醒了一个线程, 退出前接力唤醒下一个
+            tickle();
             break;
         }
-        do {
-            if(next_timeout == 0) {
-                next_timeout = MAX_TIMEOUT;
+        uint64_t start = max_spin_us ? getTimeUsec() : 0;
+        // 忙等时不登记睡眠, 投递任务的线程不必 tickle, 由这里轮询发现
+        bool spun = false;
+        if(max_spin_us && avg_gap_us <= max_spin_us && next_timeout) {
+            uint64_t spin_us = std::min(std::min(avg_gap_us * 2 + 1, max_spin_us), next_timeout);
+            spun = busyPoll(loop, events, batch_events, spin_us, rt);
+            if(spun) {
+                ++m_spinHit;
+            } else {
+                ++m_spinMiss;
             }
-            else {
-                if(next_timeout > MAX_TIMEOUT) {
-                    next_timeout = MAX_TIMEOUT;
+        }
+        if(!spun) {
+            next_timeout = prepareSleep(loop);
+            do {
+                rt = EpollWaitUs(loop->epfd, events, batch_events, next_timeout);
+                if(rt < 0 && errno == EINTR) {
+                    continue;
                 }
+                else {
+                    break;
+                }
+            } while(true);
+            --loop->sleeping;
+        }
+        if(max_spin_us) {
+            uint64_t gap = getTimeUsec() - start;
+            avg_gap_us = avg_gap_us - avg_gap_us / 8 + gap / 8;
+        }
+
+        if(rt == batch_events) {
+            batch_events = std::min(batch_events * 2, max_events);
+            shrink_votes = 0;
+        }
+        else if(rt < batch_events / 4 && batch_events > MIN_EVENTS) {
+            if(++shrink_votes >= 8) {
+                batch_events /= 2;
+                shrink_votes = 0;
             }
-            rt = epoll_wait(m_epfd, events, 64, int(next_timeout));
-            if(rt < 0 && errno == EINTR) {
-                continue;
-            }
-            else {
-                break;
-            }
-        } while(true);
+        }
 
-        std::vector<Func> cbs;
+        // 到期定时器与就绪事件攒成一批, 处理完后一次投递, 最多唤醒一次
         listExpiredCb(cbs);
-        if(!cbs.empty()) {
-            schedule(cbs.begin(), cbs.end());
-            cbs.clear();
+        for(auto& cb : cbs) {
+            batch.emplace_back(&cb, -1);
         }
+        cbs.clear();
 
+        size_t fired = 0;
         for(int i = 0; i < rt; ++i) {
             epoll_event& event = events[i];
-            if(event.data.fd == m_tickleFds[0]) {
-                uint8_t dummy[256];
-                while(read(m_tickleFds[0], dummy, sizeof(dummy)) > 0);
+            if(event.data.fd == loop->tickleFd) {
+                // 先清标记再读: 读之后到来的 tickle 会重新写入; 一次读就把计数清零
+                loop->notified = false;
+                uint64_t dummy;
+                if(read(loop->tickleFd, &dummy, sizeof(dummy)) < 0 && errno != EAGAIN) {
+                    Log_Error(g_logger) << "read eventfd errno=" << errno << " " << strerror(errno);
+                }
+                continue;
+            }
+            if(event.data.fd == m_signalFd) {
+                readSignals(batch);
                 continue;
             }
 
             FdContext* fd_ctx = (FdContext*)event.data.ptr;
             std::lock_guard<FdContext::MutexType> lock(fd_ctx->mutex);
+            // fd 已改在别的 EventPoller 上等待, 这里是旧注册的残留
+            if(fd_ctx->owner != m_id) {
+                continue;
+            }
             if(event.events & (EPOLLERR | EPOLLHUP)) {
-                event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
+                event.events |= EPOLLIN | EPOLLOUT;
             }
             int real_events = NONE;
             if(event.events & EPOLLIN) {
@@ -341,30 +1011,23 @@ void EventPoller::idle() {
                 real_events |= WRITE;
             }
 
-            if((fd_ctx->events & real_events) == NONE) {
-                continue;
-            }
-            
-            int left_events = (fd_ctx->events & ~real_events);
-            int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-            event.events = EPOLLET | left_events;
-            
-            int _rt = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
-            if(_rt) {
-                Log_Debug(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                    << op << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):"
-                    << _rt << " (" << errno << ") (" << strerror(errno) << ")";
-                continue;
-            }
-            if(real_events & READ) {
-                fd_ctx->triggerEvent(READ);
-                --m_pendingEventCount;
+            // 有等待者的事件直接触发, 其余缓存下来; 注册是常驻的, 不需要 epoll_ctl
+            int fire_events = fd_ctx->events & real_events;
+            fd_ctx->ready = (Event)(fd_ctx->ready | (real_events & ~fire_events));
+            if(fire_events & READ) {
+                fd_ctx->triggerEvent(READ, fd_ctx->read.scheduler == this
+                    ? resumeThread(fd_ctx->read.thread, owner) : -1, this, batch);
+                ++fired;
             }
-            if(real_events & WRITE) {
-                fd_ctx->triggerEvent(WRITE);
-                --m_pendingEventCount;
+            if(fire_events & WRITE) {
+                fd_ctx->triggerEvent(WRITE, fd_ctx->write.scheduler == this
+                    ? resumeThread(fd_ctx->write.thread, owner) : -1, this, batch);
+                ++fired;
             }
         }
+        // 任务入队之后才扣减, 避免其他线程在这之间误判可以退出
+        scheduleBatch(batch);
+        m_pendingEventCount -= fired;
 
         Fiber::Ptr cur = Fiber::getThis();
         auto raw_ptr = cur.get();
@@ -374,8 +1037,16 @@ void EventPoller::idle() {
     }
 }
 
-void EventPoller::flushTimer() {
-    tickle();
+int EventPoller::currentTimerShard() {
+    Worker* self = getCurrentWorker();
+    if(!self || self->index < m_timerShardBase) {
+        return -1;
+    }
+    return self->index - m_timerShardBase;
+}
+
+void EventPoller::postToTimerShard(size_t shard, Func cb) {
+    schedule(std::move(cb), getWorkerAt(shard + m_timerShardBase)->thread_id.load());
 }
 
 } // namespace sylar
@@ -4,11 +4,23 @@
 #include "thread/Mutex.h"
 #include "timer/timer.h"
 
+#include <condition_variable>
 #include <memory>
+#include <map>
+#include <signal.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct epoll_event;
 
 namespace sylar {
 
+class IoUring;
+class FdCtx;
+
 class EventPoller : public Scheduler, public TimerManager {
+// 每个 fd 的等待状态存放在 FdManager 的记录里
+friend class FdCtx;
 public:
     using Ptr = std::shared_ptr<EventPoller>;
     using MutexType = std::shared_mutex;
@@ -18,12 +30,21 @@ public:
         WRITE   = 0x4,
     };
 
+    // 事件后端, DEFAULT 时由配置 eventpoller.backend 决定
+    enum Backend {
+        DEFAULT     = 0,
+        EPOLL       = 1,
+        IO_URING    = 2,
+    };
+
 private:
     struct FdContext {
         using MutexType = std::mutex;
 
         struct EventContext {
             Scheduler* scheduler = nullptr;
+            // 登记等待的工作线程, 不是本调度器的工作线程时为-1
+            int thread = -1;
             Fiber::Ptr fiber;
             std::function<void()> cb;
         };
@@ -32,54 +53,256 @@ private:
 
         void resetContext(EventContext& ctx);
 
-        void triggerEvent(Event event);
+        // thread 不为-1时把协程或回调绑定到该线程上恢复
+        void triggerEvent(Event event, int thread = -1);
+
+        // 属于 owner 的任务放进 batch, 由调用方处理完整批事件后一次投递; 其他调度器的直接调度
+        void triggerEvent(Event event, int thread, Scheduler* owner, std::vector<FiberTask>& batch);
 
         EventContext read;
         EventContext write;
         int fd = 0;
+        // 正在等待的事件
         Event events = NONE;
+        // epoll 后端: 已到达但还没有等待者的边沿, 由下一次 addEvent 消费
+        Event ready = NONE;
+        // epoll 后端: fd 已以 EPOLLIN|EPOLLOUT|EPOLLET 常驻注册, 直到 cancelAll
+        bool registered = false;
+        // epoll 后端: 注册所在 EventPoller 的 id; 记录跨 EventPoller 复用, 别的实例留下的注册不算数
+        uint64_t owner = 0;
+        // epoll 后端: 注册所在的 Loop 下标
+        int loop = -1;
+        // io_uring 后端: 在途的完成模式 IO 个数, 以及 cancelAll 的次数(用来区分超时与关闭)
+        uint32_t asyncOps = 0;
+        uint32_t cancelSeq = 0;
         MutexType mutex;
     };
 
+    // 一个 epoll 实例和它的唤醒 eventfd
+    // 共享模式下所有工作线程等在同一个 Loop 上; 每线程模式下每个工作线程一个,
+    // fd 首次等待时注册到当时所在线程的 Loop, 此后就绪的协程都回到该线程执行
+    // io_uring 后端只有一个 Loop, 不使用其中的 fd, 只用来记录睡眠与唤醒状态
+    struct Loop {
+        int epfd = -1;
+        int tickleFd = -1;
+        // 阻塞在 epoll_wait/io_uring_enter 中的线程数, 为0时 tickle 不需要系统调用
+        std::atomic<int> sleeping = {0};
+        // 已发出唤醒但还没有被读走, 期间的 tickle 合并为一次
+        std::atomic<bool> notified = {false};
+    };
+
 public:
-    EventPoller(size_t threads = 1, bool use_caller = true, const std::string& name = "");
+    /**
+     * @param[in] backend 选 IO_URING 而内核不支持时自动退回 EPOLL
+     */
+    EventPoller(size_t threads = 1, bool use_caller = true, const std::string& name = "",
+                Backend backend = DEFAULT);
 
     ~EventPoller();
 
     static EventPoller* getThis();
 
+    /**
+     * @brief 等待 fd 上的事件, 触发时调度 cb 或当前协程
+     * @details epoll 后端下 fd 首次等待时常驻注册读写两个方向的边沿触发, 之后不再调用 epoll_ctl;
+     *          没有等待者时到达的边沿缓存在 FdContext 中
+     *          有缓存的边沿时消费它: 给出 cb 时立即调度 cb, 否则不登记, 由调用方直接重试 IO
+     * @return 0 已登记等待或已调度 cb; 1 该事件已经就绪且没有给出 cb, 当前协程没有登记; -1 出错
+     */
     int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
 
     bool delEvent(int fd, Event event);
 
     bool cancelEvent(int fd, Event event);
 
+    /**
+     * @brief 触发 fd 上所有等待, 关闭 fd 前调用
+     * @details epoll 后端的常驻注册保持不变, 这里不调用 epoll_ctl; 随 close 由内核移除,
+     *          记录里的注册状态由 FdManager::del 作废
+     */
     bool cancelAll(int fd);
 
+    Backend getBackend() const { return m_backend; }
+
+    /**
+     * @brief io_uring 后端下把一次 IO 交给内核完成, 期间挂起当前协程
+     * @param[in] op IORING_OP_RECV/IORING_OP_SEND/IORING_OP_SENDMSG 等, 参数含义与 SQE 相同
+     * @param[in] timeout_ms 超时时间, ~0ull 表示不超时
+     * @return 与对应的系统调用相同; 返回-1且 errno 为 ENOTSUP 表示当前不能使用完成模式,
+     *         调用方应退回就绪通知(addEvent)的方式
+     */
+    ssize_t asyncIo(int op, int fd, void* addr, uint32_t len, int flags, uint64_t timeout_ms);
+
     void tickle() override;
 
     void idle() override;
 
+    // timeout 为最近的定时器还有多少微秒到期
     bool stopping(uint64_t &timeout);
 
     bool stopping() override;
 
-    int m_tickleFds[2];
+    /**
+     * @brief 是否每个工作线程各有一个 epoll 实例(配置 eventpoller.per_thread_loop)
+     */
+    bool isPerThreadLoop() const { return m_loops.size() > 1; }
+
+    /**
+     * @brief 实际发出的唤醒次数(写 eventfd 或提交 NOP)
+     */
+    uint64_t getTickleIssued() const { return m_tickleIssued; }
+
+    /**
+     * @brief 因没有线程在睡眠或已有未处理的唤醒而省掉的 tickle 次数
+     */
+    uint64_t getTickleSuppressed() const { return m_tickleSuppressed; }
+
+    /**
+     * @brief 忙等期间等到了事件或任务的次数(配置 eventpoller.busy_poll_us 打开忙等)
+     */
+    uint64_t getSpinHit() const { return m_spinHit; }
+
+    /**
+     * @brief 忙等到期仍没有事件、转入阻塞等待的次数
+     */
+    uint64_t getSpinMiss() const { return m_spinMiss; }
+
+    // 就绪后是否回到登记等待的线程恢复, 见配置 eventpoller.io_affinity
+    bool isIoAffinity() const { return m_ioAffinity; }
+
+    /**
+     * @brief 开启 io_affinity 后, 就绪时回到登记线程恢复的次数
+     */
+    uint64_t getIoPinned() const { return m_ioPinned; }
+
+    /**
+     * @brief 开启 io_affinity 后, 登记线程负载过高、改由其他线程恢复的次数
+     */
+    uint64_t getIoMigrated() const { return m_ioMigrated; }
+
+    /**
+     * @brief 经 signalfd 接收信号 signo, 每次到达时把 cb 作为任务调度; 同一信号再次登记时替换回调
+     * @details 信号在调用线程和本调度器创建的工作线程中被屏蔽, 不再以异步方式打断 epoll_wait;
+     *          之后创建的线程继承屏蔽。工作线程在下一次进入 idle 时屏蔽新登记的信号, 从不为此阻塞:
+     *          由工作线程调用时, 返回后的短暂窗口内信号仍可能按原处理方式投递给还没屏蔽的工作线程;
+     *          由其他线程调用时会等到所有创建出的工作线程都已屏蔽再返回。
+     *          use_caller 的根线程不是调用线程时, 与进程内其他已存在的线程一样需要自行屏蔽。
+     *          只有一个线程会读取 signalfd, 期间到达的同一信号可能合并为一次。
+     * @return signo 无效或创建 signalfd 失败时返回false
+     */
+    bool addSignalHandler(int signo, std::function<void()> cb);
+
 private:
-    void contextResize(size_t size);
+    // 取 FdManager 中 fd 记录里的等待状态; create 为 false 时只查找, 还没有记录或越界时返回nullptr
+    FdContext* getFdContext(int fd, bool create);
+
+    // 每个运行调度循环的工作线程一个定时器分片; use_caller 的线程只在 stop 时才进入调度循环, 有其他线程时不分配
+    int currentTimerShard() override;
+
+    // 以绑定到分片所属线程的任务投递, 唤醒与接力唤醒同收件箱
+    void postToTimerShard(size_t shard, Func cb) override;
+
+    // 设置定时器松弛(eventpoller.timer_slack_ns), 屏蔽已登记的信号
+    void onThreadStart() override;
+
+    // 当前线程对应的 Loop, 不是工作线程时在创建出的工作线程的 Loop 间轮流分配
+    size_t selectLoop();
+
+    // 唤醒等在该 Loop 上的一个线程, 没有线程在睡眠或已经唤醒过时返回false
+    bool tickleLoop(size_t idx);
+
+    // 登记睡眠并复查任务, 返回本次最多可以睡多少微秒
+    uint64_t prepareSleep(Loop* loop);
+
+    // 在 spin_us 微秒内反复非阻塞地检查 epoll 与任务队列, 等到事件或任务时返回true, rt 为事件个数
+    bool busyPoll(Loop* loop, epoll_event* events, int max_events, uint64_t spin_us, int& rt);
+
+    void idleUring();
+
+    // 就绪的等待者在哪个线程恢复: 开启 io_affinity 时回到登记线程 waiter, 它负载过高时不绑定;
+    // 否则为 fallback
+    int resumeThread(int waiter, int fallback);
 
-    void flushTimer() override;
+    // 读空 signalfd, 把对应的回调放进 batch
+    void readSignals(std::vector<FiberTask>& batch);
+
+    // 第一次登记信号时把 signalfd 交给后端轮询, 调用方需持有 m_signalMtx
+    bool registerSignalFd(int fd);
+
+    // 工作线程在每轮 idle 开头调用: 信号集有更新时屏蔽新登记的信号
+    void syncSignalMask();
+
+    // 创建出的工作线程是否都已屏蔽第 gen 版信号集
+    bool signalMaskApplied(uint32_t gen);
+
+    // io_uring 后端: 为 signalfd 提交一次 POLL_ADD, 每次完成后重新提交
+    void armSignalUring();
+
+    // 返回完成的等待个数, 由调用方在整批投递之后从 m_pendingEventCount 中扣除
+    size_t handleCqe(const io_uring_cqe& cqe, std::vector<FiberTask>& batch);
+
+    /**
+     * @brief 在 SQ 锁下调用 prep 填写 SQE 并提交
+     * @details force 为false且没有空闲线程时不立即提交, 由下一个进入 idle 的线程批量提交
+     */
+    template<class F>
+    bool uringSubmit(F prep, bool force);
+
+    void uringCancelPoll(FdContext* fd_ctx, Event event);
 
 private:
-    int m_epfd;
-    
-    MutexType m_mtx;
+    Backend m_backend = EPOLL;
+
+    std::vector<std::unique_ptr<Loop> > m_loops;
+
+    std::atomic<size_t> m_nextLoop = {0};
+
+    std::atomic<uint64_t> m_tickleIssued = {0};
+
+    std::atomic<uint64_t> m_tickleSuppressed = {0};
+
+    std::atomic<uint64_t> m_spinHit = {0};
+
+    std::atomic<uint64_t> m_spinMiss = {0};
 
+    bool m_ioAffinity = false;
+
+    int m_ioAffinityMaxLoad = 100;
+
+    std::atomic<uint64_t> m_ioPinned = {0};
+
+    std::atomic<uint64_t> m_ioMigrated = {0};
+
+    std::unique_ptr<IoUring> m_uring;
+    
     std::atomic<size_t> m_pendingEventCount = {0};
 
-    std::vector<FdContext*> m_fdContexts;
+    // 第一次 addSignalHandler 时创建, 不计入 m_pendingEventCount, 不影响退出
+    std::atomic<int> m_signalFd = {-1};
+
+    std::mutex m_signalMtx;
+
+    sigset_t m_signalMask;
+
+    // 信号集的版本, 在 m_signalMtx 下递增
+    std::atomic<uint32_t> m_signalGen = {0};
+
+    // 每个工作线程已屏蔽的信号集版本, 下标同 Worker::index
+    std::unique_ptr<std::atomic<uint32_t>[]> m_signalApplied;
+
+    // 工作线程屏蔽了新版本时通知, 与 m_signalMtx 配对
+    std::condition_variable m_signalCond;
+
+    std::map<int, std::function<void()> > m_signalHandlers;
+
+    // 进程内唯一, 用来识别 FdContext 中的注册是否属于本实例
+    uint64_t m_id;
+
+    // 第 i 个定时器分片属于第 i + m_timerShardBase 个工作线程
+    size_t m_timerShardBase = 0;
 
-    static const int MAX_TIMEOUT = 3000;
+    // 单次睡眠的上限, 微秒
+    static const uint64_t MAX_TIMEOUT = 3000 * 1000;
 };
 
 } // namespace sylar
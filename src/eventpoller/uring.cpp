@@ -0,0 +1,175 @@
+#include "eventpoller/uring.h"
+#include "log/logger.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace sylar {
+
+static Logger::Ptr g_logger = Name_Logger("system");
+
+static inline unsigned load_acquire(const unsigned* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(unsigned* p, unsigned v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+IoUring::~IoUring() {
+    if(m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if(m_cqRing && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if(m_sqRing) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if(m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+bool IoUring::init(uint32_t entries) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    // 完成通知不打断正在用户态运行的线程, 等它下次进入内核时再处理
+    p.flags = IORING_SETUP_COOP_TASKRUN;
+
+    int fd = syscall(__NR_io_uring_setup, entries, &p);
+    if(fd < 0) {
+        Log_Info(g_logger) << "io_uring_setup(" << entries << ") errno=" << errno
+            << " " << strerror(errno);
+        return false;
+    }
+    m_fd = fd;
+
+    // 等待超时依赖 EXT_ARG, 溢出不丢 CQE 依赖 NODROP
+    const uint32_t required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if((p.features & required) != required) {
+        Log_Info(g_logger) << "io_uring features=" << p.features << " missing required bits";
+        return false;
+    }
+
+    m_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if(m_cqRingSize > m_sqRingSize) {
+        m_sqRingSize = m_cqRingSize;
+    }
+    m_cqRingSize = m_sqRingSize;
+
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(m_sqRing == MAP_FAILED) {
+        m_sqRing = nullptr;
+        return false;
+    }
+    m_cqRing = m_sqRing;
+
+    m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        return false;
+    }
+    m_sqes = (io_uring_sqe*)sqes;
+
+    char* sq = (char*)m_sqRing;
+    m_sqHead = (unsigned*)(sq + p.sq_off.head);
+    m_sqTail = (unsigned*)(sq + p.sq_off.tail);
+    m_sqMask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    m_sqEntries = *(unsigned*)(sq + p.sq_off.ring_entries);
+    m_sqLocalTail = *m_sqTail;
+    // SQE 下标与 array 一一对应, 之后不再修改
+    unsigned* array = (unsigned*)(sq + p.sq_off.array);
+    for(unsigned i = 0; i < m_sqEntries; ++i) {
+        array[i] = i;
+    }
+
+    char* cq = (char*)m_cqRing;
+    m_cqHead = (unsigned*)(cq + p.cq_off.head);
+    m_cqTail = (unsigned*)(cq + p.cq_off.tail);
+    m_cqMask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+int IoUring::enter(unsigned to_submit, unsigned min_complete, unsigned flags, void* arg, size_t argsz) {
+    return syscall(__NR_io_uring_enter, m_fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+io_uring_sqe* IoUring::getSqeNonLock() {
+    while(m_sqLocalTail - load_acquire(m_sqHead) >= m_sqEntries) {
+        // 没有 SQPOLL 时内核在 enter 中同步消费 SQ, 返回后就有空位
+        int rt = enter(*m_sqTail - load_acquire(m_sqHead), 0, 0, nullptr, 0);
+        if(rt < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            Log_Error(g_logger) << "io_uring_enter submit errno=" << errno
+                << " " << strerror(errno);
+            return nullptr;
+        }
+    }
+    io_uring_sqe* sqe = &m_sqes[m_sqLocalTail & m_sqMask];
+    ++m_sqLocalTail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+void IoUring::discardNonLock() {
+    m_sqLocalTail = *m_sqTail;
+}
+
+void IoUring::commitNonLock() {
+    store_release(m_sqTail, m_sqLocalTail);
+    // 与空闲线程登记空闲后进入 wait 的顺序配对, 见 EventPoller::uringSubmit
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+int IoUring::submit() {
+    unsigned pending = *m_sqTail - load_acquire(m_sqHead);
+    if(pending == 0) {
+        return 0;
+    }
+    int rt;
+    do {
+        rt = enter(pending, 0, 0, nullptr, 0);
+    } while(rt < 0 && errno == EINTR);
+    return rt;
+}
+
+int IoUring::wait(uint64_t timeout_us) {
+    __kernel_timespec ts;
+    ts.tv_sec = timeout_us / 1000000;
+    ts.tv_nsec = (timeout_us % 1000000) * 1000;
+
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+
+    // 实际提交的个数少于 to_submit 时内核不会等待, 只能传当前未提交的个数;
+    // 与其他线程的并发提交最多导致一次提前返回
+    unsigned pending = load_acquire(m_sqTail) - load_acquire(m_sqHead);
+    int rt = enter(pending, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if(rt < 0 && (errno == ETIME || errno == EINTR || errno == EBUSY)) {
+        return 0;
+    }
+    return rt;
+}
+
+unsigned IoUring::reap(io_uring_cqe* cqes, unsigned max) {
+    std::lock_guard<std::mutex> lock(m_cqMtx);
+    unsigned head = *m_cqHead;
+    unsigned tail = load_acquire(m_cqTail);
+    unsigned n = 0;
+    while(head != tail && n < max) {
+        cqes[n++] = m_cqes[head & m_cqMask];
+        ++head;
+    }
+    store_release(m_cqHead, head);
+    return n;
+}
+
+} // namespace sylar
@@ -0,0 +1,96 @@
+#ifndef _SYLAR_URING_H_
+#define _SYLAR_URING_H_
+
+#include <linux/io_uring.h>
+#include <mutex>
+#include <stdint.h>
+
+#include "util/util.h"
+
+namespace sylar {
+
+/**
+ * @brief 最小的 io_uring 封装, 直接使用系统调用, 不依赖 liburing
+ * @details 多个线程共享一个 ring: SQ 由 mutex 保护, 填好的 SQE 先积攒在 ring 中,
+ *          由 submit()/wait() 一次 io_uring_enter 批量提交; CQ 由 reap() 在另一把锁下消费。
+ *          需要内核 5.19 以上(IORING_SETUP_COOP_TASKRUN, 按 fd 取消), 否则 init 失败。
+ */
+class IoUring : noncopyable {
+public:
+    ~IoUring();
+
+    /**
+     * @brief 创建 ring
+     * @return 内核不支持时返回false, 调用方应退回 epoll
+     */
+    bool init(uint32_t entries);
+
+    bool isValid() const { return m_fd >= 0; }
+
+    std::mutex& sqMutex() { return m_sqMtx; }
+
+    /**
+     * @brief 取一个清零的 SQE, ring 满时先提交已发布的
+     * @attention 调用方需持有 sqMutex(), 填好后调用 commitNonLock
+     */
+    io_uring_sqe* getSqeNonLock();
+
+    /**
+     * @brief 把之前取到的 SQE 一起对内核可见, 不会立即提交
+     * @details 链接的请求要在同一次 commit 中发布, 避免被拆到两次提交里
+     */
+    void commitNonLock();
+
+    /**
+     * @brief 放弃取到但还没有发布的 SQE
+     */
+    void discardNonLock();
+
+    /**
+     * @brief 提交所有未提交的 SQE
+     * @return 提交的个数, 出错返回-1
+     */
+    int submit();
+
+    /**
+     * @brief 提交未提交的 SQE 并等待至少一个完成, 最多 timeout_us 微秒
+     * @return 出错返回-1, 超时或被信号打断不算错误
+     */
+    int wait(uint64_t timeout_us);
+
+    /**
+     * @brief 取出至多 max 个已完成的 CQE
+     */
+    unsigned reap(io_uring_cqe* cqes, unsigned max);
+
+private:
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags, void* arg, size_t argsz);
+
+private:
+    int m_fd = -1;
+    void* m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    void* m_cqRing = nullptr;
+    size_t m_cqRingSize = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    unsigned* m_sqHead = nullptr;
+    unsigned* m_sqTail = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned m_sqEntries = 0;
+    // 用户态维护的 SQ 尾, 由 m_sqMtx 保护
+    unsigned m_sqLocalTail = 0;
+
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+
+    std::mutex m_sqMtx;
+    std::mutex m_cqMtx;
+};
+
+} // namespace sylar
+
+#endif //_SYLAR_URING_H_
@@ -0,0 +1,147 @@
+#include "fiber/channel.h"
+#include "util/macro.h"
+
+#include <algorithm>
+
+namespace sylar {
+
+void ChannelBase::close() {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if(m_closed) {
+        return;
+    }
+    m_closed = true;
+    // 剩余数据仍可接收, 只有通道为空时接收者才会在等待
+    while(ChannelWaiter* waiter = PopWaiter(m_receivers)) {
+        waiter->ok = false;
+        waiter->parker->notify();
+    }
+    while(ChannelWaiter* waiter = PopWaiter(m_senders)) {
+        waiter->ok = false;
+        waiter->parker->notify();
+    }
+}
+
+bool ChannelBase::isClosed() {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_closed;
+}
+
+ChannelWaiter* ChannelBase::PopWaiter(std::deque<ChannelWaiter*>& waiters) {
+    while(!waiters.empty()) {
+        ChannelWaiter* waiter = waiters.front();
+        waiters.pop_front();
+        if(!waiter->fired) {
+            return waiter;
+        }
+        int expect = -1;
+        if(waiter->fired->compare_exchange_strong(expect, waiter->index)) {
+            return waiter;
+        }
+    }
+    return nullptr;
+}
+
+void ChannelBase::removeWaiterNonLock(ChannelWaiter* waiter) {
+    auto it = std::find(m_senders.begin(), m_senders.end(), waiter);
+    if(it != m_senders.end()) {
+        m_senders.erase(it);
+        return;
+    }
+    it = std::find(m_receivers.begin(), m_receivers.end(), waiter);
+    if(it != m_receivers.end()) {
+        m_receivers.erase(it);
+    }
+}
+
+bool ChannelBase::wait(void* value, bool send) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    int rt = send ? trySendNonLock(value) : tryRecvNonLock(value);
+    if(rt) {
+        return rt > 0;
+    }
+    FiberWaiter parker;
+    ChannelWaiter waiter;
+    waiter.parker = &parker;
+    waiter.value = value;
+    (send ? m_senders : m_receivers).push_back(&waiter);
+    // 对方在 m_mtx 下完成交接并设置 ok 后才唤醒
+    parker.wait(lock);
+    return waiter.ok;
+}
+
+int Select(std::initializer_list<SelectCase> cases, bool block) {
+    size_t n = cases.size();
+    if(n == 0) {
+        return -1;
+    }
+    const SelectCase* cs = cases.begin();
+
+    std::vector<ChannelBase*> chans;
+    chans.reserve(n);
+    for(auto& i : cases) {
+        chans.push_back(i.chan);
+    }
+    std::sort(chans.begin(), chans.end());
+    chans.erase(std::unique(chans.begin(), chans.end()), chans.end());
+
+    // 按地址顺序对所有涉及的通道加锁, 避免与其他 select 死锁
+    std::vector<std::unique_lock<std::mutex> > locks;
+    locks.reserve(chans.size());
+    for(auto i : chans) {
+        locks.emplace_back(i->m_mtx);
+    }
+
+    // 轮换起点, 多个分支同时就绪时不总是偏向第一个
+    static thread_local size_t s_start = 0;
+    size_t start = s_start++ % n;
+    for(size_t k = 0; k < n; ++k) {
+        size_t i = (start + k) % n;
+        ChannelBase* chan = cs[i].chan;
+        int rt = cs[i].send ? chan->trySendNonLock(cs[i].value) : chan->tryRecvNonLock(cs[i].value);
+        if(rt) {
+            if(cs[i].ok) {
+                *cs[i].ok = rt > 0;
+            }
+            return (int)i;
+        }
+    }
+    if(!block) {
+        return -1;
+    }
+
+    // 所有通道都已加锁, 尝试与入队之间不会漏掉任何一方
+    FiberWaiter parker;
+    std::atomic<int> fired = {-1};
+    std::vector<ChannelWaiter> waiters(n);
+    for(size_t i = 0; i < n; ++i) {
+        waiters[i].parker = &parker;
+        waiters[i].value = cs[i].value;
+        waiters[i].fired = &fired;
+        waiters[i].index = (int)i;
+        (cs[i].send ? cs[i].chan->m_senders : cs[i].chan->m_receivers).push_back(&waiters[i]);
+    }
+    locks.clear();
+
+    parker.wait();
+
+    // 完成的分支已被对方出队, 其余的在这里撤销
+    int idx = fired;
+    Assert((idx >= 0 && (size_t)idx < n));
+    for(auto i : chans) {
+        locks.emplace_back(i->m_mtx);
+    }
+    for(size_t i = 0; i < n; ++i) {
+        if((int)i != idx) {
+            cs[i].chan->removeWaiterNonLock(&waiters[i]);
+        }
+    }
+    locks.clear();
+
+    if(cs[idx].ok) {
+        *cs[idx].ok = waiters[idx].ok;
+    }
+    return idx;
+}
+
+} // namespace sylar
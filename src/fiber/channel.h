@@ -0,0 +1,201 @@
+#ifndef _SYLAR_CHANNEL_H_
+#define _SYLAR_CHANNEL_H_
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <initializer_list>
+
+#include "fiber/fiber_mutex.h"
+#include "util/util.h"
+
+namespace sylar {
+
+class ChannelBase;
+
+// 阻塞在通道上的一次 send/recv, 位于等待者的栈上
+struct ChannelWaiter {
+    FiberWaiter* parker = nullptr;
+    // send 时指向待发送的值, recv 时指向接收位置
+    void* value = nullptr;
+    // 完成时置为true, 因通道关闭而结束时为false
+    bool ok = false;
+    // select 中多个等待共享一个 fired, 先把它从 -1 改成自己 index 的一方完成这次等待
+    std::atomic<int>* fired = nullptr;
+    int index = 0;
+};
+
+/**
+ * @brief select 的一个分支, 由 Channel::sendCase/recvCase 构造
+ */
+struct SelectCase {
+    ChannelBase* chan;
+    bool send;
+    void* value;
+    bool* ok;
+};
+
+/**
+ * @brief 在多个通道操作中选一个可以完成的执行, 都不能完成时挂起直到其中一个完成
+ * @param[in] block 为false时不挂起, 都不能完成直接返回-1
+ * @return 完成的分支下标; 分支的 ok 为false表示通道已关闭
+ */
+int Select(std::initializer_list<SelectCase> cases, bool block = true);
+
+/**
+ * @brief 与元素类型无关的部分: 等待队列与 select 支持
+ */
+class ChannelBase : noncopyable {
+public:
+    virtual ~ChannelBase() {}
+
+    void close();
+
+    bool isClosed();
+
+protected:
+    friend int Select(std::initializer_list<SelectCase> cases, bool block);
+
+    // 以下 NonLock 接口调用方需持有 m_mtx
+    // 返回 1 完成, 0 需要等待, -1 通道已关闭
+    virtual int trySendNonLock(void* value) = 0;
+
+    virtual int tryRecvNonLock(void* value) = 0;
+
+    // 取出第一个仍有效的等待者并认领它; select 中已被其他分支完成的等待者直接丢弃
+    static ChannelWaiter* PopWaiter(std::deque<ChannelWaiter*>& waiters);
+
+    void removeWaiterNonLock(ChannelWaiter* waiter);
+
+    // 单个通道上的阻塞 send/recv, 先尝试, 不能完成时挂起
+    bool wait(void* value, bool send);
+
+protected:
+    std::mutex m_mtx;
+    bool m_closed = false;
+    std::deque<ChannelWaiter*> m_senders;
+    std::deque<ChannelWaiter*> m_receivers;
+};
+
+/**
+ * @brief 协程间传递消息的通道
+ * @details 阻塞时挂起协程而不是线程。
+ *          有接收者在等待时, send 直接把值移动到接收者的位置, 不经过缓冲区;
+ *          容量为0时每次 send 都要与 recv 直接交接。
+ *          关闭后 send 失败, recv 仍可取完缓冲区中剩余的值。
+ */
+template<class T>
+class Channel : public ChannelBase {
+public:
+    using Ptr = std::shared_ptr<Channel>;
+
+    static constexpr size_t UNBOUNDED = ~(size_t)0;
+
+    explicit Channel(size_t capacity = UNBOUNDED)
+        :m_capacity(capacity) {
+    }
+
+    /**
+     * @brief 发送, 缓冲区满时挂起
+     * @return 通道已关闭时返回false
+     */
+    bool send(T value) {
+        return wait(&value, true);
+    }
+
+    /**
+     * @brief 接收, 没有数据时挂起
+     * @return 通道已关闭且没有剩余数据时返回false
+     */
+    bool recv(T& value) {
+        return wait(&value, false);
+    }
+
+    /**
+     * @brief 不挂起的发送, 失败时 value 保持不变
+     */
+    bool trySend(T& value) {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return trySendNonLock(&value) > 0;
+    }
+
+    bool trySend(T&& value) {
+        return trySend(value);
+    }
+
+    /**
+     * @brief 不挂起的接收
+     */
+    bool tryRecv(T& value) {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return tryRecvNonLock(&value) > 0;
+    }
+
+    // 发送完成后 value 被移走
+    SelectCase sendCase(T& value, bool* ok = nullptr) {
+        return SelectCase{this, true, &value, ok};
+    }
+
+    SelectCase recvCase(T& value, bool* ok = nullptr) {
+        return SelectCase{this, false, &value, ok};
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_buffer.size();
+    }
+
+    size_t capacity() const { return m_capacity; }
+
+protected:
+    int trySendNonLock(void* value) override {
+        T& v = *(T*)value;
+        if(m_closed) {
+            return -1;
+        }
+        if(ChannelWaiter* waiter = PopWaiter(m_receivers)) {
+            *(T*)waiter->value = std::move(v);
+            waiter->ok = true;
+            waiter->parker->notify();
+            return 1;
+        }
+        if(m_buffer.size() < m_capacity) {
+            m_buffer.push_back(std::move(v));
+            return 1;
+        }
+        return 0;
+    }
+
+    int tryRecvNonLock(void* value) override {
+        T& v = *(T*)value;
+        if(!m_buffer.empty()) {
+            v = std::move(m_buffer.front());
+            m_buffer.pop_front();
+            // 腾出了位置, 让一个阻塞的发送者补进来
+            if(ChannelWaiter* waiter = PopWaiter(m_senders)) {
+                m_buffer.push_back(std::move(*(T*)waiter->value));
+                waiter->ok = true;
+                waiter->parker->notify();
+            }
+            return 1;
+        }
+        // 容量为0时直接从发送者取
+        if(ChannelWaiter* waiter = PopWaiter(m_senders)) {
+            v = std::move(*(T*)waiter->value);
+            waiter->ok = true;
+            waiter->parker->notify();
+            return 1;
+        }
+        return m_closed ? -1 : 0;
+    }
+
+private:
+    size_t m_capacity;
+    std::deque<T> m_buffer;
+};
+
+} // namespace sylar
+
+#endif //_SYLAR_CHANNEL_H_
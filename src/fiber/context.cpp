@@ -0,0 +1,102 @@
+#include "fiber/context.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+// System V AMD64: 保存 rbp rbx r12-r15, 以及 MXCSR 和 x87 控制字
+// rdi = from_sp, rsi = to_sp
+asm(R"(
+.text
+.globl sylar_swap_context
+.type sylar_swap_context,@function
+.align 16
+sylar_swap_context:
+    pushq %rbp
+    pushq %rbx
+    pushq %r15
+    pushq %r14
+    pushq %r13
+    pushq %r12
+    leaq -8(%rsp), %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    leaq 8(%rsp), %rsp
+    popq %r12
+    popq %r13
+    popq %r14
+    popq %r15
+    popq %rbx
+    popq %rbp
+    ret
+.size sylar_swap_context,.-sylar_swap_context
+)");
+
+void* sylar_make_context(void* stack, size_t size, void (*fn)()) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t* sp = (uint64_t*)top;
+    // fn 的返回地址, fn 不会返回
+    *--sp = 0;
+    // ret 弹出后跳转到 fn, 此时 rsp + 8 按 16 字节对齐, 与普通函数调用一致
+    *--sp = (uint64_t)fn;
+    // rbp rbx r15 r14 r13 r12
+    for(int i = 0; i < 6; ++i) {
+        *--sp = 0;
+    }
+    // 低 4 字节 MXCSR = 0x1F80, 随后 2 字节 x87 控制字 = 0x037F
+    *--sp = 0x0000037F00001F80ull;
+    return sp;
+}
+
+#elif defined(__aarch64__)
+// AAPCS64: 保存 x19-x28, fp(x29), lr(x30), d8-d15
+// x0 = from_sp, x1 = to_sp
+asm(R"(
+.text
+.globl sylar_swap_context
+.type sylar_swap_context,%function
+.align 4
+sylar_swap_context:
+    sub sp, sp, #0xa0
+    stp x19, x20, [sp, #0x00]
+    stp x21, x22, [sp, #0x10]
+    stp x23, x24, [sp, #0x20]
+    stp x25, x26, [sp, #0x30]
+    stp x27, x28, [sp, #0x40]
+    stp x29, x30, [sp, #0x50]
+    stp d8,  d9,  [sp, #0x60]
+    stp d10, d11, [sp, #0x70]
+    stp d12, d13, [sp, #0x80]
+    stp d14, d15, [sp, #0x90]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp x19, x20, [sp, #0x00]
+    ldp x21, x22, [sp, #0x10]
+    ldp x23, x24, [sp, #0x20]
+    ldp x25, x26, [sp, #0x30]
+    ldp x27, x28, [sp, #0x40]
+    ldp x29, x30, [sp, #0x50]
+    ldp d8,  d9,  [sp, #0x60]
+    ldp d10, d11, [sp, #0x70]
+    ldp d12, d13, [sp, #0x80]
+    ldp d14, d15, [sp, #0x90]
+    add sp, sp, #0xa0
+    ret
+.size sylar_swap_context,.-sylar_swap_context
+)");
+
+void* sylar_make_context(void* stack, size_t size, void (*fn)()) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t* sp = (uint64_t*)(top - 0xa0);
+    memset(sp, 0, 0xa0);
+    // x30(lr), ret 后从 fn 开始执行
+    sp[11] = (uint64_t)fn;
+    return sp;
+}
+
+#endif
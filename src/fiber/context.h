@@ -0,0 +1,115 @@
+#ifndef _SYLAR_CONTEXT_H_
+#define _SYLAR_CONTEXT_H_
+
+#include <stddef.h>
+#include <ucontext.h>
+
+// 汇编实现的上下文切换只保存被调用者保存寄存器, 不像 glibc 的 swapcontext 那样
+// 每次切换都调用 rt_sigprocmask。编译时定义 SYLAR_FIBER_UCONTEXT 可退回 ucontext。
+#if defined(__x86_64__) || defined(__aarch64__)
+    #define SYLAR_HAVE_ASM_CONTEXT 1
+#endif
+
+#if !defined(SYLAR_HAVE_ASM_CONTEXT) && !defined(SYLAR_FIBER_UCONTEXT)
+    #define SYLAR_FIBER_UCONTEXT 1
+#endif
+
+#ifdef SYLAR_HAVE_ASM_CONTEXT
+extern "C" {
+/**
+ * @brief 保存当前寄存器到栈上, 栈顶写入 *from_sp, 然后切换到 to_sp 并恢复
+ */
+void sylar_swap_context(void** from_sp, void* to_sp);
+
+/**
+ * @brief 在 [stack, stack + size) 上构造初始栈帧, 首次切入时从 fn 开始执行
+ * @return 供 sylar_swap_context 使用的栈顶
+ * @attention fn 不能返回
+ */
+void* sylar_make_context(void* stack, size_t size, void (*fn)());
+}
+#endif
+
+namespace sylar {
+
+class Context {
+public:
+    using Entry = void (*)();
+
+    /**
+     * @brief 在给定的栈上构造入口为 fn 的上下文
+     */
+    bool make(void* stack, size_t size, Entry fn) {
+#ifdef SYLAR_FIBER_UCONTEXT
+        if(getcontext(&m_ctx)) {
+            return false;
+        }
+        m_ctx.uc_link = nullptr;
+        m_ctx.uc_stack.ss_sp = stack;
+        m_ctx.uc_stack.ss_size = size;
+        makecontext(&m_ctx, fn, 0);
+        return true;
+#else
+        m_sp = sylar_make_context(stack, size, fn);
+        return m_sp != nullptr;
+#endif
+    }
+
+    /**
+     * @brief 保存当前执行状态到 from, 切换到 to
+     */
+    static bool Swap(Context& from, Context& to) {
+#ifdef SYLAR_FIBER_UCONTEXT
+        return swapcontext(&from.m_ctx, &to.m_ctx) == 0;
+#else
+        sylar_swap_context(&from.m_sp, to.m_sp);
+        return true;
+#endif
+    }
+
+    /**
+     * @brief 切出后保存的栈指针, [getSp(), 栈顶) 即为该上下文正在使用的栈
+     * @return 当前平台不支持时返回nullptr
+     */
+    void* getSp() const {
+#ifndef SYLAR_FIBER_UCONTEXT
+        return m_sp;
+#elif defined(__x86_64__)
+        return (void*)m_ctx.uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+        return (void*)m_ctx.uc_mcontext.sp;
+#else
+        return nullptr;
+#endif
+    }
+
+    /**
+     * @brief 是否能取得切出后的栈指针(共享栈模式依赖它)
+     */
+    static bool CanShareStack() {
+#if !defined(SYLAR_FIBER_UCONTEXT) || defined(__x86_64__) || defined(__aarch64__)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    static const char* Backend() {
+#ifdef SYLAR_FIBER_UCONTEXT
+        return "ucontext";
+#else
+        return "asm";
+#endif
+    }
+
+private:
+#ifdef SYLAR_FIBER_UCONTEXT
+    ucontext_t m_ctx;
+#else
+    void* m_sp = nullptr;
+#endif
+};
+
+} // namespace sylar
+
+#endif //_SYLAR_CONTEXT_H_
@@ -5,6 +5,12 @@
 
 #include "fiber/scheduler.h"
 
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
 namespace sylar {
 
 // #define FIBER_SWAP_DEBUG
@@ -20,17 +26,192 @@ static thread_local Fiber::Ptr t_threadFiber = nullptr;
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size =
     Config::Lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
 
+static ConfigVar<uint32_t>::ptr g_fiber_stack_pool_max =
+    Config::Lookup<uint32_t>("fiber.stack_pool_max", 1024, "max cached fiber stacks across all threads");
+
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size =
+    Config::Lookup<uint32_t>("fiber.shared_stack_size", 1024 * 1024, "per-thread shared fiber stack size");
+
+static ConfigVar<bool>::ptr g_fiber_stack_watermark =
+    Config::Lookup<bool>("fiber.stack_watermark", false, "fill fiber stacks with a canary and measure peak usage");
+
+static std::atomic<uint64_t> s_stack_mapped {0};
+static std::atomic<uint64_t> s_stack_cached {0};
+static std::atomic<uint64_t> s_stack_hits {0};
+static std::atomic<uint64_t> s_stack_misses {0};
+
+/**
+ * @brief 协程栈分配器
+ * @details 栈用 mmap 分配, 低地址端一页设为 PROT_NONE 作为保护页, 栈溢出直接触发 SIGSEGV。
+ *          释放的栈放入当前线程的缓存池, 下次分配同样大小时直接复用;
+ *          所有线程缓存的栈总数不超过 fiber.stack_pool_max, 超出的直接 munmap。
+ */
 class StackAllocator {
 public:
     static void* Alloc(size_t size) {
-        return malloc(size);
+        size = RoundUp(size);
+        void* vp = t_pool_alive ? t_pool.pop(size) : nullptr;
+        if(vp) {
+            --s_stack_cached;
+            ++s_stack_hits;
+            return vp;
+        }
+        ++s_stack_misses;
+
+        size_t guard = PageSize();
+        void* base = mmap(nullptr, size + guard, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if(base == MAP_FAILED) {
+            Log_Error(g_logger) << "fiber stack mmap(" << size + guard << ") failed errno="
+                << errno << " errstr=" << strerror(errno);
+            return nullptr;
+        }
+        if(mprotect(base, guard, PROT_NONE)) {
+            Log_Error(g_logger) << "fiber stack guard mprotect failed errno="
+                << errno << " errstr=" << strerror(errno);
+            munmap(base, size + guard);
+            return nullptr;
+        }
+        ++s_stack_mapped;
+        return (char*)base + guard;
     }
 
     static void Dealloc(void* vp, size_t size) {
-        return free(vp);
+        size = RoundUp(size);
+        if(t_pool_alive
+                && s_stack_cached < g_fiber_stack_pool_max->getValue()
+                && t_pool.push(vp, size)) {
+            ++s_stack_cached;
+            return;
+        }
+        Unmap(vp, size);
+    }
+
+private:
+    static size_t PageSize() {
+        static size_t s_page_size = sysconf(_SC_PAGESIZE);
+        return s_page_size;
+    }
+
+    static size_t RoundUp(size_t size) {
+        size_t page = PageSize();
+        return (size + page - 1) / page * page;
+    }
+
+    static void Unmap(void* vp, size_t size) {
+        size_t guard = PageSize();
+        munmap((char*)vp - guard, size + guard);
+        --s_stack_mapped;
     }
+
+    // 每个线程的空闲栈, 按大小分几条链表, 链接指针存放在栈顶(已被使用过的页)
+    struct Pool {
+        struct FreeList {
+            size_t size = 0;
+            void* head = nullptr;
+        };
+
+        static void*& Next(void* vp, size_t size) {
+            return *(void**)((char*)vp + size - sizeof(void*));
+        }
+
+        void* pop(size_t size) {
+            for(auto& i : lists) {
+                if(i.size == size && i.head) {
+                    void* vp = i.head;
+                    i.head = Next(vp, size);
+                    return vp;
+                }
+            }
+            return nullptr;
+        }
+
+        bool push(void* vp, size_t size) {
+            FreeList* list = nullptr;
+            for(auto& i : lists) {
+                if(i.size == size) {
+                    list = &i;
+                    break;
+                }
+                if(!list && !i.head) {
+                    list = &i;
+                }
+            }
+            if(!list) {
+                return false;
+            }
+            list->size = size;
+            Next(vp, size) = list->head;
+            list->head = vp;
+            return true;
+        }
+
+        ~Pool() {
+            t_pool_alive = false;
+            for(auto& i : lists) {
+                while(i.head) {
+                    void* vp = i.head;
+                    i.head = Next(vp, i.size);
+                    --s_stack_cached;
+                    Unmap(vp, i.size);
+                }
+            }
+        }
+
+        FreeList lists[4];
+    };
+
+    // 线程退出时 t_pool 可能先于仍持有栈的协程析构, 此后直接 munmap
+    static thread_local bool t_pool_alive;
+    static thread_local Pool t_pool;
 };
 
+thread_local bool StackAllocator::t_pool_alive = true;
+thread_local StackAllocator::Pool StackAllocator::t_pool;
+
+/**
+ * @brief 线程共享栈
+ * @details 共享栈协程都在同一块栈上运行, 切出后把 [sp, 栈顶) 拷贝到协程自己的缓冲区,
+ *          再次切入时拷回。occupant 记录当前栈上内容属于哪个协程, 仍是自己时不用拷回。
+ */
+struct SharedStack {
+    SharedStack() {
+        size = g_fiber_shared_stack_size->getValue();
+        stack = StackAllocator::Alloc(size);
+        Assert_Commit(stack, "shared stack alloc failed");
+    }
+
+    ~SharedStack() {
+        StackAllocator::Dealloc(stack, size);
+    }
+
+    char* top() const { return (char*)stack + size; }
+
+    void* stack;
+    size_t size;
+    // 协程可能在其他线程析构, 只做比较, 不会解引用
+    std::atomic<Fiber*> occupant = {nullptr};
+};
+
+static SharedStack* GetSharedStack() {
+    static thread_local std::unique_ptr<SharedStack> s_shared(new SharedStack);
+    return s_shared.get();
+}
+
+// ucontext 保存的 sp 之下可能仍有红区数据, 多拷一点
+static const size_t s_red_zone = 128;
+
+static const uint64_t s_stack_canary = 0xa5a5a5a5a5a5a5a5ull;
+
+Fiber::StackStats Fiber::GetStackStats() {
+    StackStats stats;
+    stats.mapped = s_stack_mapped;
+    stats.cached = s_stack_cached;
+    stats.hits = s_stack_hits;
+    stats.misses = s_stack_misses;
+    return stats;
+}
+
 Fiber::Fiber() {
     m_state = EXEC;
 
@@ -39,17 +220,14 @@ Fiber::Fiber() {
 
     // m_stackSize = g_fiber_stack_size->getValue();
     // m_stack = StackAllocator::Alloc(m_stackSize);
-    
-    if(getcontext(&m_ctx)) {
-        Assert_Commit(false, "Fibier get context failed");
-    }
+    // 主协程的上下文在第一次切出时保存
 
     setThis(this);
 
     Log_Info(g_logger) << "Main Fiber created " << m_id;
 }
 
-Fiber::Fiber(FuncType cb, size_t stacksize, bool use_caller) {
+Fiber::Fiber(FuncType cb, size_t stacksize, bool use_caller, bool shared_stack) {
     m_state = INIT;
 
     m_id = ++s_fiber_id;
@@ -59,23 +237,23 @@ Fiber::Fiber(FuncType cb, size_t stacksize, bool use_caller) {
     Log_Debug(g_logger) << "Fiber Count " << s_fiber_count;
 
     m_cb = std::forward<FuncType>(cb);
+    m_entryType = m_cb ? &m_cb.target_type() : &typeid(void);
+    m_entry = use_caller ? &Fiber::CallerMainFunc : &Fiber::MainFunc;
+
+    if(shared_stack && Context::CanShareStack()) {
+        // 栈在第一次切入时才确定
+        m_sharedStack = true;
+        m_needMake = true;
+        return;
+    }
 
     m_stackSize = stacksize ? stacksize : g_fiber_stack_size->getValue();
     m_stack = StackAllocator::Alloc(m_stackSize);
+    Assert_Commit(m_stack, "Fiber stack alloc failed");
+    fillStack();
 
-    if(getcontext(&m_ctx)) {
-        Assert_Commit(false, "Fibier get context failed");
-    }
-
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stackSize;
-
-    if(use_caller) {
-        makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
-    }
-    else {
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
+    if(!m_ctx.make(m_stack, m_stackSize, m_entry)) {
+        Assert_Commit(false, "Fibier make context failed");
     }
 }
 
@@ -86,6 +264,14 @@ Fiber::~Fiber() {
         Assert((m_state == INIT || m_state == TERM));
         StackAllocator::Dealloc(m_stack, m_stackSize);
     }
+    else if(m_sharedStack) {
+        Assert((m_state == INIT || m_state == TERM));
+        if(m_shared) {
+            Fiber* self = this;
+            m_shared->occupant.compare_exchange_strong(self, nullptr);
+        }
+        free(m_saveBuf);
+    }
     else {
         Assert(!m_cb);
         Assert((m_state == EXEC));
@@ -97,22 +283,27 @@ Fiber::~Fiber() {
 }
 
 void Fiber::reset(FuncType cb) {
-    Assert(m_stack);
+    Assert((m_stack || m_sharedStack));
     Assert((m_state == INIT || m_state == TERM || m_state == EXCEPT));
 
     m_cb = std::forward<FuncType>(cb);
-    
-    if(getcontext(&m_ctx)) {
-        Assert_Commit(false, "Fibier get context failed");
+    m_entryType = m_cb ? &m_cb.target_type() : &typeid(void);
+    m_stackHighWater = 0;
+
+    if(m_sharedStack) {
+        m_entry = &Fiber::MainFunc;
+        m_needMake = true;
+        m_saveSize = 0;
+        m_state = INIT;
+        return;
     }
 
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stackSize;
+    fillStack();
+    if(!m_ctx.make(m_stack, m_stackSize, &Fiber::MainFunc)) {
+        Assert_Commit(false, "Fibier make context failed");
+    }
 
     m_state = INIT;
-
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
 }
 
 Fiber::Ptr Fiber::getThis() {
@@ -134,11 +325,14 @@ void Fiber::call() {
 #ifdef FIBER_SWAP_DEBUG
     Log_Debug(g_logger) << "Fiber: " << m_id << " call " << t_threadFiber->m_id;
 #endif //FIBER_SWAP_DEBUG
+    prepareSwitchIn();
     setThis(this);
     m_state = EXEC;
-    if(swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
+    if(!Context::Swap(t_threadFiber->m_ctx, m_ctx)) {
         Assert_Commit(false, "swapcontext");
     }
+    saveStack();
+    measureStack();
 }
 
 void Fiber::back() {
@@ -146,7 +340,7 @@ void Fiber::back() {
     Log_Debug(g_logger) << "Fiber: " << m_id << " back " << t_threadFiber->m_id;
 #endif
     setThis(t_threadFiber.get());
-    if(swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
+    if(!Context::Swap(m_ctx, t_threadFiber->m_ctx)) {
         Assert_Commit(false, "swapcontext");
     }
 }
@@ -155,12 +349,95 @@ void Fiber::swapIn() {
 #ifdef FIBER_SWAP_DEBUG
     Log_Debug(g_logger) << "Fiber: " << m_id << " swapped in " << Scheduler::getMainFiber()->m_id;
 #endif
-    setThis(this);
     Assert((m_state != EXEC));
+    prepareSwitchIn();
+    setThis(this);
     m_state = EXEC;
-    if(swapcontext(&Scheduler::getMainFiber()->m_ctx, &m_ctx)) {
+    if(!Context::Swap(Scheduler::getMainFiber()->m_ctx, m_ctx)) {
         Assert_Commit(false, "Fiber swap failed");
     }
+    saveStack();
+    measureStack();
+}
+
+void Fiber::prepareSwitchIn() {
+    if(!m_sharedStack) {
+        return;
+    }
+    if(!m_shared) {
+        m_shared = GetSharedStack();
+        m_ownerThread = getThreadId();
+    }
+    Assert_Commit((m_ownerThread == getThreadId()), "shared stack fiber resumed on another thread");
+
+    if(m_needMake) {
+        m_needMake = false;
+        m_saveSize = 0;
+        m_shared->occupant = this;
+        if(!m_ctx.make(m_shared->stack, m_shared->size, m_entry)) {
+            Assert_Commit(false, "Fibier make context failed");
+        }
+        return;
+    }
+    if(m_shared->occupant.exchange(this) != this) {
+        restoreStack();
+    }
+}
+
+// 在调用方的栈上执行, 此时刚切出的协程不在运行
+void Fiber::saveStack() {
+    if(!m_sharedStack || m_state == TERM || m_state == EXCEPT) {
+        return;
+    }
+    char* top = m_shared->top();
+    char* sp = (char*)m_ctx.getSp();
+    if(sp - (char*)m_shared->stack > (ptrdiff_t)s_red_zone) {
+        sp -= s_red_zone;
+    }
+    else {
+        sp = (char*)m_shared->stack;
+    }
+    size_t size = top - sp;
+    if(size > m_saveCap) {
+        free(m_saveBuf);
+        m_saveCap = (size + 255) & ~(size_t)255;
+        m_saveBuf = (char*)malloc(m_saveCap);
+        Assert_Commit(m_saveBuf, "shared stack save buffer alloc failed");
+    }
+    memcpy(m_saveBuf, sp, size);
+    m_saveSize = size;
+    if(size > m_stackHighWater) {
+        m_stackHighWater = size;
+    }
+}
+
+void Fiber::restoreStack() {
+    memcpy(m_shared->top() - m_saveSize, m_saveBuf, m_saveSize);
+}
+
+// 填充整个栈会让所有页常驻, 只用于测量
+void Fiber::fillStack() {
+    m_watermark = g_fiber_stack_watermark->getValue();
+    if(m_watermark) {
+        memset(m_stack, (int)(s_stack_canary & 0xff), m_stackSize);
+    }
+}
+
+// 栈从高地址向低地址增长, 从栈底向上找第一个被改写的字
+void Fiber::measureStack() {
+    if(!m_watermark || (m_state != TERM && m_state != EXCEPT)) {
+        return;
+    }
+    m_watermark = false;
+    const uint64_t* begin = (const uint64_t*)m_stack;
+    const uint64_t* end = begin + m_stackSize / sizeof(uint64_t);
+    const uint64_t* it = begin;
+    while(it != end && *it == s_stack_canary) {
+        ++it;
+    }
+    m_stackHighWater = (const char*)end - (const char*)it;
+    Log_Debug(g_logger) << "Fiber " << m_id << " stack high water " << m_stackHighWater
+        << "/" << m_stackSize;
 }
 
 // void Fiber::swapOut() {
@@ -185,7 +462,7 @@ void Fiber::swapOut() {
     Log_Debug(g_logger) << "Fiber: " << m_id << " swapped out to " << Scheduler::getMainFiber()->m_id;
 #endif
     setThis(Scheduler::getMainFiber());
-    if(swapcontext(&m_ctx, &Scheduler::getMainFiber()->m_ctx)) {
+    if(!Context::Swap(m_ctx, Scheduler::getMainFiber()->m_ctx)) {
         Assert_Commit(false, "Fiber swap failed");
     }
 }
@@ -193,7 +470,8 @@ void Fiber::swapOut() {
 void Fiber::yieldToHold() {
     auto cur = getThis();
     Assert((cur->m_state == EXEC));
-    cur->m_state = HOLD;
+    // 保持 EXEC 直到真正切出: 唤醒方可能在切出完成前就把它交给其他线程,
+    // 调度器见到 EXEC 会先放回队列, 切回调度协程后再由调度器置为 HOLD
     cur->swapOut();
 }
 
@@ -1,17 +1,34 @@
 #ifndef _SYLAR_FIBER_H_
 #define _SYLAR_FIBER_H_
 
+#include <atomic>
 #include <memory>
 #include <functional>
-#include <ucontext.h>
+#include <typeinfo>
+
+#include "fiber/context.h"
 
 namespace sylar {
 
+struct SharedStack;
+
 class Fiber : public std::enable_shared_from_this<Fiber> {
 public:
     using Ptr = std::shared_ptr<Fiber>;
     using FuncType = std::function<void()>;
 
+    // 协程栈缓存池统计(所有线程合计)
+    struct StackStats {
+        // 当前已 mmap 的栈(使用中 + 缓存中)
+        uint64_t mapped = 0;
+        // 缓存池中空闲的栈
+        uint64_t cached = 0;
+        // 从缓存池复用的次数
+        uint64_t hits = 0;
+        // 新 mmap 的次数
+        uint64_t misses = 0;
+    };
+
     enum State {
         INIT,
         HOLD,
@@ -26,12 +43,12 @@ private:
 
 public:
     // 栈大小传0表示使用默认大小
-    Fiber(FuncType cb, size_t stacksize = 0, bool use_caller = true);
+    // shared_stack 为 true 时运行在线程共享栈上, 切出后只把用到的部分拷贝保存,
+    // 此后只能在首次运行它的线程上恢复, stacksize 被忽略
+    Fiber(FuncType cb, size_t stacksize = 0, bool use_caller = true, bool shared_stack = false);
 
     ~Fiber();
 
-    ucontext_t getContext() { return std::move(m_ctx); }
-
     void reset(FuncType cb);
 
     void swapIn();
@@ -47,6 +64,21 @@ public:
     uint64_t getId() { return m_id; }
 
     void setState(State _state) { m_state = _state; }
+
+    bool isSharedStack() const { return m_sharedStack; }
+
+    // 共享栈协程所属的线程, 未运行过或私有栈协程返回 -1
+    int getOwnerThread() const { return m_ownerThread; }
+
+    // 共享栈协程切出时保存的字节数
+    size_t getSavedSize() const { return m_saveSize; }
+
+    // 开启 fiber.stack_watermark 后, 协程结束时测得的栈使用峰值(字节), 未测量时为0
+    // 共享栈协程取各次切出时保存的最大字节数
+    size_t getStackHighWater() const { return m_stackHighWater; }
+
+    // 入口回调的类型, 用于按入口汇总栈使用量
+    const std::type_info& getEntryType() const { return *m_entryType; }
 public:
     static void setThis(Fiber* _f);
 
@@ -61,13 +93,26 @@ public:
 
     static uint64_t GetFiberId();
 
+    static StackStats GetStackStats();
+
     static void MainFunc();
 
     static void CallerMainFunc();
+private:
+    void prepareSwitchIn();
+
+    void saveStack();
+
+    void restoreStack();
+
+    void fillStack();
+
+    void measureStack();
 private:
     uint64_t m_id;
 
-    State m_state;
+    // 其他线程据此判断协程是否已切出(见 yieldToHold)
+    std::atomic<State> m_state;
     
     FuncType m_cb;
 
@@ -75,21 +120,42 @@ private:
 
     uint32_t m_stackSize;
     
-    ucontext_t m_ctx;
+    Context m_ctx;
+
+    Context::Entry m_entry = nullptr;
+
+    bool m_sharedStack = false;
+    // 共享栈上的上下文推迟到切入时再构造, 避免覆盖其他协程正在使用的栈
+    bool m_needMake = false;
+    int m_ownerThread = -1;
+    SharedStack* m_shared = nullptr;
+    char* m_saveBuf = nullptr;
+    size_t m_saveSize = 0;
+    size_t m_saveCap = 0;
+
+    // 栈已用金丝雀填充, 结束时扫描得到峰值
+    bool m_watermark = false;
+    size_t m_stackHighWater = 0;
+    const std::type_info* m_entryType = &typeid(void);
 };
 
 struct FiberTask {
     Fiber::Ptr fiber;
     std::function<void()> cb;
     int thread_id;
+    // cb 任务是否在共享栈协程中执行
+    bool shared_stack = false;
 
     FiberTask(): thread_id(-1) {}
 
     FiberTask(Fiber::Ptr _fiber, int _thread)
-        : fiber(_fiber), thread_id (_thread) {}
+        : fiber(_fiber), thread_id (_thread) {
+        bindOwner();
+    }
 
     FiberTask(Fiber::Ptr* _fiber, int _thread) : thread_id(_thread) {
         fiber.swap(*_fiber);
+        bindOwner();
     }
 
     FiberTask(std::function<void()> _cb, int _thread)  : thread_id(_thread) {
@@ -104,6 +170,14 @@ struct FiberTask {
         fiber = nullptr;
         cb = nullptr;
         thread_id = -1;
+        shared_stack = false;
+    }
+
+    // 共享栈协程的栈内容依赖地址, 只能回到所属线程恢复
+    void bindOwner() {
+        if(fiber && fiber->getOwnerThread() != -1) {
+            thread_id = fiber->getOwnerThread();
+        }
     }
 };
 
@@ -0,0 +1,181 @@
+#include "fiber/fiber_mutex.h"
+#include "fiber/scheduler.h"
+#include "util/macro.h"
+
+namespace sylar {
+
+FiberWaiter::FiberWaiter() {
+    // 调度协程、普通线程以及 run 之外的根线程不能 yield, 只能阻塞线程
+    Scheduler* scheduler = Scheduler::getRunningThis();
+    if(scheduler) {
+        m_fiber = Fiber::getThis();
+        m_scheduler = scheduler;
+    }
+}
+
+void FiberWaiter::wait() {
+    if(!m_scheduler) {
+        m_sem.wait();
+        return;
+    }
+    // 唤醒方可能在切出完成前就重新调度它, 调度器会等它切出后再恢复
+    Fiber::yieldToHold();
+}
+
+void FiberWaiter::notify() {
+    if(!m_scheduler) {
+        m_sem.notify();
+        return;
+    }
+    Scheduler* scheduler = m_scheduler;
+    Fiber::Ptr fiber = std::move(m_fiber);
+    scheduler->schedule(std::move(fiber));
+}
+
+void FiberWaitQueue::wait(std::unique_lock<std::mutex>& lock) {
+    FiberWaiter waiter;
+    m_waiters.push_back(&waiter);
+    waiter.wait(lock);
+}
+
+bool FiberWaitQueue::notifyOne() {
+    if(m_waiters.empty()) {
+        return false;
+    }
+    FiberWaiter* waiter = m_waiters.front();
+    m_waiters.pop_front();
+    waiter->notify();
+    return true;
+}
+
+size_t FiberWaitQueue::notifyAll() {
+    size_t n = m_waiters.size();
+    while(notifyOne());
+    return n;
+}
+
+FiberSemaphore::FiberSemaphore(uint32_t count)
+    :m_count(count) {
+}
+
+void FiberSemaphore::wait() {
+    if(m_count.fetch_sub(1, std::memory_order_acquire) > 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(m_mtx);
+    if(m_pending) {
+        --m_pending;
+        return;
+    }
+    m_waiters.wait(lock);
+}
+
+bool FiberSemaphore::tryWait() {
+    int64_t count = m_count.load(std::memory_order_relaxed);
+    while(count > 0) {
+        if(m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void FiberSemaphore::notify(size_t n) {
+    while(n--) {
+        if(m_count.fetch_add(1, std::memory_order_release) >= 0) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if(!m_waiters.notifyOne()) {
+            ++m_pending;
+        }
+    }
+}
+
+void FiberCondition::wait(FiberMutex::Lock& lock) {
+    Assert(lock.owns_lock());
+    // 先入队再释放用户锁, notify 不会丢
+    std::unique_lock<std::mutex> guard(m_mtx);
+    lock.unlock();
+    m_waiters.wait(guard);
+    lock.lock();
+}
+
+void FiberCondition::notify_one() {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_waiters.notifyOne();
+}
+
+void FiberCondition::notify_all() {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_waiters.notifyAll();
+}
+
+// 读写锁的释放与等待者计数之间需要全序, 原子操作都用默认的 seq_cst
+bool FiberRWMutex::try_lock() {
+    int32_t expect = 0;
+    return m_state.compare_exchange_strong(expect, WRITER);
+}
+
+void FiberRWMutex::lock() {
+    if(try_lock()) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(m_mtx);
+    ++m_writers;
+    ++m_waiters;
+    while(!try_lock()) {
+        m_queue.wait(lock);
+        lock.lock();
+    }
+    --m_waiters;
+    --m_writers;
+}
+
+void FiberRWMutex::unlock() {
+    m_state.store(0);
+    if(m_waiters > 0) {
+        wakeAll();
+    }
+}
+
+bool FiberRWMutex::try_lock_shared() {
+    int32_t state = m_state.load();
+    return state != WRITER && m_writers == 0
+        && m_state.compare_exchange_strong(state, state + 1);
+}
+
+void FiberRWMutex::lock_shared() {
+    if(try_lock_shared()) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(m_mtx);
+    ++m_waiters;
+    while(true) {
+        int32_t state = m_state.load();
+        if(state == WRITER || m_writers > 0) {
+            m_queue.wait(lock);
+            lock.lock();
+            continue;
+        }
+        // 失败只可能是与其他读者竞争, 直接重试
+        if(m_state.compare_exchange_weak(state, state + 1)) {
+            break;
+        }
+    }
+    --m_waiters;
+}
+
+void FiberRWMutex::unlock_shared() {
+    if(m_state.fetch_sub(1) == 1 && m_waiters > 0) {
+        wakeAll();
+    }
+}
+
+// 等待者被唤醒后在 m_mtx 下重新竞争, 锁释放发生在取 m_mtx 之前, 不会漏唤醒
+void FiberRWMutex::wakeAll() {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_queue.notifyAll();
+}
+
+} // namespace sylar
@@ -0,0 +1,180 @@
+#ifndef _SYLAR_FIBER_MUTEX_H_
+#define _SYLAR_FIBER_MUTEX_H_
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+
+#include "fiber/fiber.h"
+#include "thread/Mutex.h"
+#include "util/util.h"
+
+namespace sylar {
+
+class Scheduler;
+
+/**
+ * @brief 一次等待
+ * @details 构造时绑定当前协程: 在调度器中的协程通过 yieldToHold 挂起, 被唤醒时经
+ *          Scheduler::schedule 重新入队; 不在协程中的线程(或调度协程本身)退化为阻塞在信号量上。
+ *          notify 可以先于 wait 发生。
+ */
+class FiberWaiter : noncopyable {
+public:
+    FiberWaiter();
+
+    void wait();
+
+    /**
+     * @brief 释放 lock 后挂起
+     * @attention 返回时 lock 处于释放状态
+     */
+    void wait(std::unique_lock<std::mutex>& lock) {
+        lock.unlock();
+        wait();
+    }
+
+    /**
+     * @brief 唤醒等待者, 返回后不再访问本对象(等待者可能已经返回并销毁它)
+     */
+    void notify();
+
+private:
+    Fiber::Ptr m_fiber;
+    Scheduler* m_scheduler = nullptr;
+    semaphore m_sem;
+};
+
+/**
+ * @brief 协程等待队列, 所有操作都需要调用方持有与队列配对的 std::mutex
+ */
+class FiberWaitQueue : noncopyable {
+public:
+    /**
+     * @brief 把当前协程/线程加入队列, 释放 lock 后挂起
+     * @attention 返回时 lock 处于释放状态
+     */
+    void wait(std::unique_lock<std::mutex>& lock);
+
+    /**
+     * @brief 唤醒最早等待的一个
+     * @return 队列为空时返回false
+     */
+    bool notifyOne();
+
+    /**
+     * @brief 唤醒全部, 返回唤醒的个数
+     */
+    size_t notifyAll();
+
+    bool empty() const { return m_waiters.empty(); }
+
+private:
+    std::deque<FiberWaiter*> m_waiters;
+};
+
+/**
+ * @brief 协程信号量
+ * @details 计数够用时 wait/notify 只有一次原子操作;
+ *          计数不足时挂起当前协程, notify 直接把名额交给最早的等待者。
+ */
+class FiberSemaphore : noncopyable {
+public:
+    FiberSemaphore(uint32_t count = 0);
+
+    void wait();
+
+    bool tryWait();
+
+    void notify(size_t n = 1);
+
+private:
+    // 小于0时其绝对值为正在/将要等待的个数
+    std::atomic<int64_t> m_count;
+    std::mutex m_mtx;
+    // notify 时等待者已扣减计数但还没入队, 先记下名额由它入队前领取
+    uint64_t m_pending = 0;
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * @brief 协程互斥锁, 满足 Lockable, 可配合 std::lock_guard/std::unique_lock 使用
+ * @details 解锁时直接把锁交给最早的等待者, 不可重入
+ */
+class FiberMutex : noncopyable {
+public:
+    using Lock = std::unique_lock<FiberMutex>;
+
+    FiberMutex() : m_sem(1) {}
+
+    void lock() { m_sem.wait(); }
+
+    bool try_lock() { return m_sem.tryWait(); }
+
+    void unlock() { m_sem.notify(); }
+
+private:
+    FiberSemaphore m_sem;
+};
+
+/**
+ * @brief 协程条件变量, 配合 FiberMutex 使用
+ */
+class FiberCondition : noncopyable {
+public:
+    void wait(FiberMutex::Lock& lock);
+
+    template<class Predicate>
+    void wait(FiberMutex::Lock& lock, Predicate pred) {
+        while(!pred()) {
+            wait(lock);
+        }
+    }
+
+    void notify_one();
+
+    void notify_all();
+
+private:
+    std::mutex m_mtx;
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * @brief 协程读写锁, 写优先, 可配合 std::unique_lock/std::shared_lock 使用
+ * @details 无竞争时加读锁/写锁都只有一次原子操作;
+ *          有写者等待时新的读者也会挂起, 避免写者饿死。
+ */
+class FiberRWMutex : noncopyable {
+public:
+    void lock();
+
+    bool try_lock();
+
+    void unlock();
+
+    void lock_shared();
+
+    bool try_lock_shared();
+
+    void unlock_shared();
+
+private:
+    void wakeAll();
+
+private:
+    static constexpr int32_t WRITER = -1;
+
+    // WRITER 表示写锁被持有, 否则为持有读锁的个数
+    std::atomic<int32_t> m_state = {0};
+    // 慢路径上等待的读者/写者个数
+    std::atomic<int32_t> m_waiters = {0};
+    std::atomic<int32_t> m_writers = {0};
+    std::mutex m_mtx;
+    FiberWaitQueue m_queue;
+};
+
+} // namespace sylar
+
+#endif //_SYLAR_FIBER_MUTEX_H_
@@ -0,0 +1,345 @@
+#ifndef _SYLAR_FUTURE_H_
+#define _SYLAR_FUTURE_H_
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "fiber/fiber_mutex.h"
+#include "util/util.h"
+
+namespace sylar {
+
+/**
+ * @brief Future/Promise 共享的状态, 侵入式引用计数
+ * @details 在协程中等待只挂起当前协程, 不在协程中时阻塞线程。
+ */
+class FutureStateBase : noncopyable {
+public:
+    virtual ~FutureStateBase() {}
+
+    void addRef() { m_ref.fetch_add(1, std::memory_order_relaxed); }
+
+    void release() {
+        if(m_ref.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    bool isReady() const { return m_ready.load(std::memory_order_acquire); }
+
+    void wait() {
+        if(isReady()) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(m_mtx);
+        if(m_ready) {
+            return;
+        }
+        // 只在结果就绪时唤醒
+        m_waiters.wait(lock);
+    }
+
+    /**
+     * @brief 结果就绪后执行 cb, 已就绪时立即在当前线程执行
+     */
+    void onReady(std::function<void()> cb) {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if(!m_ready) {
+                m_callbacks.push_back(std::move(cb));
+                return;
+            }
+        }
+        cb();
+    }
+
+    void setException(std::exception_ptr ex) {
+        claim();
+        setClaimedException(ex);
+    }
+
+protected:
+    // 占下结果, 之后才能写入; 重复设置时在写入之前抛出, 不会覆盖正在被读取的结果
+    void claim() {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if(m_claimed) {
+            throw std::logic_error("future result already set");
+        }
+        m_claimed = true;
+    }
+
+    void setClaimedException(std::exception_ptr ex) {
+        m_exception = ex;
+        markReady();
+    }
+
+    // 调用方已经 claim 并写入了结果
+    void markReady() {
+        std::vector<std::function<void()> > cbs;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_ready.store(true, std::memory_order_release);
+            m_waiters.notifyAll();
+            cbs.swap(m_callbacks);
+        }
+        for(auto& i : cbs) {
+            i();
+        }
+    }
+
+    void rethrow() {
+        if(m_exception) {
+            std::rethrow_exception(m_exception);
+        }
+    }
+
+private:
+    std::atomic<int> m_ref = {1};
+    std::atomic<bool> m_ready = {false};
+    // 结果已被某个 setValue/setException 占下, 在 m_mtx 下修改
+    bool m_claimed = false;
+    std::mutex m_mtx;
+    FiberWaitQueue m_waiters;
+    std::vector<std::function<void()> > m_callbacks;
+    std::exception_ptr m_exception;
+};
+
+// 结果直接存放在状态对象内, 不单独分配
+template<class T>
+class FutureState : public FutureStateBase {
+public:
+    ~FutureState() {
+        if(m_hasValue) {
+            ptr()->~T();
+        }
+    }
+
+    template<class... Args>
+    void setValue(Args&&... args) {
+        this->claim();
+        try {
+            new (&m_storage) T(std::forward<Args>(args)...);
+        } catch(...) {
+            // 已经占下, 构造失败时以异常作为结果
+            this->setClaimedException(std::current_exception());
+            return;
+        }
+        m_hasValue = true;
+        markReady();
+    }
+
+    T& get() {
+        wait();
+        rethrow();
+        return *ptr();
+    }
+
+private:
+    T* ptr() { return std::launder(reinterpret_cast<T*>(&m_storage)); }
+
+private:
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type m_storage;
+    bool m_hasValue = false;
+};
+
+template<>
+class FutureState<void> : public FutureStateBase {
+public:
+    void setValue() {
+        claim();
+        markReady();
+    }
+
+    void get() {
+        wait();
+        rethrow();
+    }
+};
+
+/**
+ * @brief 调度任务的状态, 任务与结果在同一次分配中
+ */
+template<class T, class F>
+class TaskState : public FutureState<T> {
+public:
+    TaskState(F&& fn)
+        :m_fn(std::move(fn)) {
+    }
+
+    void run() {
+        try {
+            if constexpr (std::is_void<T>::value) {
+                (*m_fn)();
+                m_fn.reset();
+                this->setValue();
+            }
+            else {
+                T value = (*m_fn)();
+                m_fn.reset();
+                this->setValue(std::move(value));
+            }
+        }
+        catch (...) {
+            m_fn.reset();
+            this->setException(std::current_exception());
+        }
+    }
+
+private:
+    // 执行完即析构, 尽早释放捕获的资源
+    std::optional<F> m_fn;
+};
+
+/**
+ * @brief 异步结果, 可复制, 多个持有者共享同一结果
+ */
+template<class T>
+class Future {
+public:
+    using StateType = FutureState<T>;
+
+    Future() {}
+
+    // 接管 state 的一个引用
+    explicit Future(StateType* state)
+        :m_state(state) {
+    }
+
+    Future(const Future& rhs)
+        :m_state(rhs.m_state) {
+        if(m_state) {
+            m_state->addRef();
+        }
+    }
+
+    Future(Future&& rhs)
+        :m_state(rhs.m_state) {
+        rhs.m_state = nullptr;
+    }
+
+    Future& operator=(Future rhs) {
+        std::swap(m_state, rhs.m_state);
+        return *this;
+    }
+
+    ~Future() {
+        if(m_state) {
+            m_state->release();
+        }
+    }
+
+    bool valid() const { return m_state != nullptr; }
+
+    bool isReady() const { return m_state->isReady(); }
+
+    void wait() const { m_state->wait(); }
+
+    /**
+     * @brief 等待并返回结果, 任务抛出的异常在这里重新抛出
+     */
+    typename std::add_lvalue_reference<T>::type get() const { return m_state->get(); }
+
+    void onReady(std::function<void()> cb) const { m_state->onReady(std::move(cb)); }
+
+private:
+    StateType* m_state = nullptr;
+};
+
+template<class T>
+class Promise {
+public:
+    Promise()
+        :m_state(new FutureState<T>) {
+    }
+
+    Promise(Promise&& rhs)
+        :m_state(rhs.m_state) {
+        rhs.m_state = nullptr;
+    }
+
+    Promise(const Promise&) = delete;
+    Promise& operator=(const Promise&) = delete;
+
+    // 未设置结果就析构时, 等待者收到异常
+    ~Promise() {
+        if(m_state) {
+            if(!m_state->isReady()) {
+                m_state->setException(std::make_exception_ptr(std::runtime_error("broken promise")));
+            }
+            m_state->release();
+        }
+    }
+
+    Future<T> getFuture() {
+        m_state->addRef();
+        return Future<T>(m_state);
+    }
+
+    template<class... Args>
+    void setValue(Args&&... args) {
+        m_state->setValue(std::forward<Args>(args)...);
+    }
+
+    void setException(std::exception_ptr ex) {
+        m_state->setException(ex);
+    }
+
+private:
+    FutureState<T>* m_state;
+};
+
+/**
+ * @brief 所有 future 都就绪(包括以异常结束)时就绪
+ */
+template<class T>
+Future<void> whenAll(const std::vector<Future<T> >& futures) {
+    auto promise = std::make_shared<Promise<void> >();
+    Future<void> result = promise->getFuture();
+    if(futures.empty()) {
+        promise->setValue();
+        return result;
+    }
+    auto left = std::make_shared<std::atomic<size_t> >(futures.size());
+    for(auto& i : futures) {
+        i.onReady([promise, left]() {
+            if(--*left == 0) {
+                promise->setValue();
+            }
+        });
+    }
+    return result;
+}
+
+/**
+ * @brief 任意一个 future 就绪时就绪, 结果为它的下标
+ */
+template<class T>
+Future<size_t> whenAny(const std::vector<Future<T> >& futures) {
+    auto promise = std::make_shared<Promise<size_t> >();
+    Future<size_t> result = promise->getFuture();
+    if(futures.empty()) {
+        promise->setException(std::make_exception_ptr(std::invalid_argument("whenAny on empty set")));
+        return result;
+    }
+    auto fired = std::make_shared<std::atomic<bool> >(false);
+    for(size_t i = 0; i < futures.size(); ++i) {
+        futures[i].onReady([promise, fired, i]() {
+            if(!fired->exchange(true)) {
+                promise->setValue(i);
+            }
+        });
+    }
+    return result;
+}
+
+} // namespace sylar
+
+#endif //_SYLAR_FUTURE_H_
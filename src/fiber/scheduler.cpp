@@ -2,13 +2,21 @@
 #include "util/macro.h"
 #include "util/util.h"
 #include "thread/Mutex.h"
+#include "config/config.h"
+
+#include <stdlib.h>
+#include <sstream>
 
 namespace sylar {
 
 static Logger::Ptr g_logger = Name_Logger("system");
 
+static ConfigVar<bool>::ptr g_scheduler_work_stealing =
+    Config::Lookup<bool>("scheduler.work_stealing", true, "per-thread run queues with work stealing");
+
 static thread_local Scheduler* t_scheduler = nullptr;
 static thread_local Fiber* t_scheduler_fiber = nullptr;
+static thread_local Scheduler::Worker* t_worker = nullptr;
 
 Scheduler* Scheduler::getThis() {
     return t_scheduler;
@@ -18,10 +26,98 @@ Fiber* Scheduler::getMainFiber() {
     return t_scheduler_fiber;
 }
 
+Scheduler* Scheduler::getRunningThis() {
+    if(!t_scheduler || !t_worker || Fiber::getThis().get() == t_scheduler_fiber) {
+        return nullptr;
+    }
+    return t_scheduler;
+}
+
 void Scheduler::setThis() {
     t_scheduler = this;
 }
 
+Scheduler::TaskQueue* Scheduler::getLocalQueue() {
+    if(!m_workStealing || t_scheduler != this || !t_worker) {
+        return nullptr;
+    }
+    return &t_worker->local;
+}
+
+Scheduler::Worker* Scheduler::getCurrentWorker() {
+    return t_scheduler == this ? t_worker : nullptr;
+}
+
+Scheduler::Worker* Scheduler::getWorker(int thread) {
+    // 最常见的是绑定到当前线程
+    Worker* self = getCurrentWorker();
+    if(self && self->thread_id == thread) {
+        return self;
+    }
+    if(m_workerMapReady.load(std::memory_order_acquire)) {
+        auto it = m_workerMap.find(thread);
+        return it == m_workerMap.end() ? nullptr : it->second;
+    }
+    // start 完成之前线程id还在登记, 逐个比较
+    for(auto& i : m_workers) {
+        if(i->thread_id == thread) {
+            return i.get();
+        }
+    }
+    return nullptr;
+}
+
+int Scheduler::getWorkerLoad(int thread) {
+    Worker* worker = getWorker(thread);
+    return worker ? worker->load.getLoad() : -1;
+}
+
+bool Scheduler::scheduleTask(FiberTask&& item) {
+    Worker* worker = nullptr;
+    if(item.thread_id != -1 && (worker = getWorker(item.thread_id))) {
+        return scheduleInbox(worker, std::move(item));
+    }
+    if(item.thread_id == -1 && getLocalQueue()) {
+        return scheduleLocal(std::move(item));
+    }
+    std::lock_guard<Mutextype> lock(m_fibers_mtx);
+    return scheduleNonLock(std::move(item));
+}
+
+void Scheduler::scheduleBatch(std::vector<FiberTask>& tasks) {
+    bool need_tickle = false;
+    // 收件箱和本地队列无锁, 直接投递; 要进全局队列的先挪到前面, 之后一次加锁
+    size_t global = 0;
+    for(auto& i : tasks) {
+        if(!i.cb && !i.fiber) {
+            continue;
+        }
+        Worker* worker = nullptr;
+        if(i.thread_id != -1 && (worker = getWorker(i.thread_id))) {
+            need_tickle = scheduleInbox(worker, std::move(i)) | need_tickle;
+        }
+        else if(i.thread_id == -1 && getLocalQueue()) {
+            need_tickle = scheduleLocal(std::move(i)) | need_tickle;
+        }
+        else {
+            if(&tasks[global] != &i) {
+                tasks[global] = std::move(i);
+            }
+            ++global;
+        }
+    }
+    if(global) {
+        std::lock_guard<Mutextype> lock(m_fibers_mtx);
+        for(size_t i = 0; i < global; ++i) {
+            need_tickle = scheduleNonLock(std::move(tasks[i])) | need_tickle;
+        }
+    }
+    tasks.clear();
+    if(need_tickle) {
+        tickle();
+    }
+}
+
 LoadCounter::LoadCounter(size_t max_size) 
     :m_max_size(max_size) {
     m_last_sleep = m_last_wake = getTimeUsec();
@@ -32,10 +128,8 @@ void LoadCounter::startSleep() {
     auto current_time = getTimeUsec();
     auto run_time = current_time - m_last_wake;
     m_last_sleep = current_time;
-    {
-        std::unique_lock<MutexType> lock(m_mtx);
-        m_records.emplace_back(run_time, false);
-    }
+    std::unique_lock<MutexType> lock(m_mtx);
+    m_records.emplace_back(run_time, false);
     if (m_records.size() > m_max_size) {
         m_records.pop_front();
     }
@@ -46,10 +140,8 @@ void LoadCounter::startWork() {
     auto current_time = getTimeUsec();
     auto sleep_time = current_time - m_last_sleep;
     m_last_wake = current_time;
-    {
-        std::unique_lock<MutexType> lock(m_mtx);
-        m_records.emplace_back(sleep_time, true);
-    }
+    std::unique_lock<MutexType> lock(m_mtx);
+    m_records.emplace_back(sleep_time, true);
     if (m_records.size() > m_max_size) {
         m_records.pop_front();
     }
@@ -59,12 +151,12 @@ int LoadCounter::getLoad() {
     uint64_t totalSleepTime = 0;
     uint64_t totalRunTime = 0;
 
-    if(m_records.size() == 0) {
-        return 0;
-    }
-
     {
+        // 其他线程也会读取, 记录的增删都在锁内
         std::shared_lock<MutexType> lock(m_mtx);
+        if(m_records.size() == 0) {
+            return 0;
+        }
         for(auto& i : m_records) {
             if(i.sleep) {
                 totalSleepTime += i.duration;
@@ -98,7 +190,7 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name, c
         --threads;
         t_scheduler = this;
         
-        m_mainFiber.reset(new Fiber(std::bind(&Scheduler::run, this), 0, true));
+        m_mainFiber.reset(new Fiber(std::bind(&Scheduler::run, this, 0), 0, true));
         t_scheduler_fiber = m_mainFiber.get();
         Log_Debug(g_logger) << "scheduler_fiber id: " << t_scheduler_fiber->getId();
 
@@ -111,6 +203,16 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name, c
         m_rootThread = -1;
     }
     m_threadNum = threads;
+
+    m_workStealing = g_scheduler_work_stealing->getValue();
+    size_t workers = m_threadNum + (use_caller ? 1 : 0);
+    for(size_t i = 0; i < workers; ++i) {
+        m_workers.emplace_back(new Worker);
+        m_workers.back()->index = i;
+    }
+    if(use_caller) {
+        m_workers[0]->thread_id = m_rootThread;
+    }
     Log_Debug(g_logger) << getThreadId() << " created scheduler: " << m_name;
 }
 
@@ -136,11 +238,25 @@ void Scheduler::start() {
     {
         std::unique_lock<std::shared_mutex> lock(m_threads_mtx);
         m_threads.resize(m_threadNum);
+        size_t offset = m_rootThread == -1 ? 0 : 1;
         for(size_t i = 0; i < m_threadNum; ++i) {
-            m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(i)));
+            m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this, i + offset), m_name + "_" + std::to_string(i)));
             m_threadIds.emplace_back(m_threads[i]->getId());
+            // Thread 构造返回时线程id已确定, 此后绑定该线程的任务都能直接进入收件箱
+            m_workers[i + offset]->thread_id = m_threads[i]->getId();
+        }
+    }
+    // 只在第一次 start 时建表; 再次 start 后线程id已变, 退回逐个比较, 已发布的表不再修改
+    if(!m_workerMap.empty()) {
+        m_workerMapReady.store(false, std::memory_order_release);
+        return;
+    }
+    for(auto& i : m_workers) {
+        if(i->thread_id != -1) {
+            m_workerMap[i->thread_id] = i.get();
         }
     }
+    m_workerMapReady.store(true, std::memory_order_release);
 }
 
 void Scheduler::stop() {
@@ -167,6 +283,11 @@ void Scheduler::stop() {
     }
 
     m_running = false;
+    // 唤醒阻塞在 idle 中的工作线程, 让它们尽快检查 stopping
+    for(size_t i = 0; i < m_threadNum; ++i) {
+        tickle();
+    }
+
     std::vector<Thread::Ptr> thrs;
     {
         std::unique_lock<std::shared_mutex> lock(m_threads_mtx);
@@ -182,52 +303,164 @@ void Scheduler::stop() {
         tickle();
     }
 
-    if(!stopping()) {
+    if(m_mainFiber && !stopping()) {
         m_mainFiber->call();
     }
 }
 
-void Scheduler::run() {
+bool Scheduler::popTask(FiberTask& ft, size_t idx, bool& need_tickle) {
+    Worker* self = t_worker;
+    FiberTask* item = nullptr;
+    // 1. 绑定到本线程的任务
+    if(self->inbox.pop(ft)) {
+        if(!(ft.fiber && ft.fiber->getState() == Fiber::EXEC)) {
+            ++m_activeThreadNum;
+            return true;
+        }
+        // 协程仍在其他线程上执行(还未切出), 放回稍后再试
+        self->inbox.push(std::move(ft));
+        ft.reset();
+    }
+
+    // 2. 本地队列(LIFO, 缓存友好)
+    TaskQueue* local = getLocalQueue();
+    if(local && local->pop(item)) {
+        ft = std::move(*item);
+        delete item;
+        if(!(ft.fiber && ft.fiber->getState() == Fiber::EXEC)) {
+            ++m_activeThreadNum;
+            return true;
+        }
+        std::lock_guard<Mutextype> lock(m_fibers_mtx);
+        m_fibers.emplace_back(std::move(ft));
+        ++m_fibersCount;
+        ft.reset();
+    }
+
+    // 3. 全局注入队列
+    {
+        std::lock_guard<Mutextype> lock(m_fibers_mtx);
+        auto it = m_fibers.begin();
+        while(it != m_fibers.end()) {
+            // 绑定到不属于本调度器的线程, 没有线程会取走它
+            if(it->thread_id != -1 && it->thread_id != getThreadId()) {
+                ++it;
+                continue;
+            }
+
+            Assert((it->fiber || it->cb));
+            if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
+                ++it;
+                continue;
+            }
+
+            ft = std::move(*it);
+            it = m_fibers.erase(it);
+            --m_fibersCount;
+            ++m_activeThreadNum;
+            // 队列中还有任务, 唤醒其他线程
+            need_tickle |= (it != m_fibers.end());
+            return true;
+        }
+    }
+
+    // 4. 从其他线程的本地队列窃取(FIFO, 取最早入队的任务)
+    size_t n = m_workers.size();
+    for(size_t i = 1; local && i < n; ++i) {
+        TaskQueue* victim = &m_workers[(idx + i) % n]->local;
+        if(!victim->steal(item)) {
+            continue;
+        }
+        ft = std::move(*item);
+        delete item;
+        if(ft.fiber && ft.fiber->getState() == Fiber::EXEC) {
+            std::lock_guard<Mutextype> lock(m_fibers_mtx);
+            m_fibers.emplace_back(std::move(ft));
+            ++m_fibersCount;
+            ft.reset();
+            continue;
+        }
+        ++m_activeThreadNum;
+        need_tickle |= !victim->empty();
+        return true;
+    }
+
+    // tickle 不能指定线程, 被唤醒的可能不是收件箱的主人, 接力唤醒
+    need_tickle |= hasPendingInbox();
+    return false;
+}
+
+bool Scheduler::hasLocalTask() {
+    for(auto& i : m_workers) {
+        if(!i->local.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Scheduler::hasInboxTask() {
+    for(auto& i : m_workers) {
+        if(!i->inbox.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Scheduler::hasPendingInbox() {
+    for(auto& i : m_workers) {
+        if(i.get() != t_worker && i->idle && !i->inbox.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Scheduler::hasPendingTask() {
+    Worker* self = getCurrentWorker();
+    if(self && !self->inbox.empty()) {
+        return true;
+    }
+    if(getLocalQueue() && hasLocalTask()) {
+        return true;
+    }
+    // 忙等时会被反复调用, 全局队列为空时不加锁
+    if(m_fibersCount == 0) {
+        return false;
+    }
+    std::lock_guard<Mutextype> lock(m_fibers_mtx);
+    for(auto& i : m_fibers) {
+        if(i.thread_id == -1 || i.thread_id == getThreadId()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Scheduler::run(size_t idx) {
     Log_Debug(g_logger) << "Scheduler::run()";
     // startWork();
     Scheduler::setThis();
     set_hook_enable(true);
     if(getThreadId() != m_rootThread) {
         t_scheduler_fiber = Fiber::getThis().get();
+        onThreadStart();
     }
 
+    Assert((idx < m_workers.size()));
+    Worker* self = m_workers[idx].get();
+    self->thread_id = getThreadId();
+    t_worker = self;
+
     Fiber::Ptr cb_fiber;
+    Fiber::Ptr shared_cb_fiber;
     FiberTask ft;
     Fiber::Ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this), 0, false));
     while(true) {
         ft.reset();
         bool needTickle = false;
-        bool isActive = false;
-        {
-            std::lock_guard<std::mutex> lock(m_fibers_mtx);
-            auto it = m_fibers.begin();
-            while(it != m_fibers.end()) {
-                if(it->thread_id != -1 && it->thread_id != getThreadId()) {
-                    needTickle = true;
-                    ++it;
-                    continue;
-                }
-
-                Assert((it->fiber || it->cb));
-                if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
-                    ++it;
-                    continue;
-                }
-
-                isActive = true;
-
-                ft = *it;
-                m_fibers.erase(it);
-                ++m_activeThreadNum;
-                break;
-            }
-            needTickle |= (it == m_fibers.end());
-        }
+        bool isActive = popTask(ft, idx, needTickle);
 
         if(needTickle) {
             tickle();
@@ -245,31 +478,36 @@ void Scheduler::run() {
                     && ft.fiber->getState() != Fiber::EXCEPT) {
                         ft.fiber->setState(Fiber::HOLD);
                 }
+                else {
+                    recordStackUsage(ft.fiber);
+                }
             }
         }
         else if(ft.cb) {
-            if(cb_fiber) {
-                cb_fiber->reset(ft.cb);
+            // 共享栈与私有栈的回调协程分别复用
+            Fiber::Ptr& fiber = ft.shared_stack ? shared_cb_fiber : cb_fiber;
+            if(fiber) {
+                fiber->reset(ft.cb);
             } else {
-                cb_fiber.reset(new Fiber(ft.cb, 0, false));
+                fiber.reset(new Fiber(ft.cb, 0, false, ft.shared_stack));
             }
             int _thread = ft.thread_id;
             ft.reset();
-            cb_fiber->swapIn();
+            fiber->swapIn();
             --m_activeThreadNum;
-            if(cb_fiber->getState() == Fiber::READY) {
-                schedule(cb_fiber, _thread);
-                cb_fiber.reset();
+            if(fiber->getState() == Fiber::READY) {
+                schedule(fiber, _thread);
+                fiber.reset();
             }
             else {
-                if(cb_fiber->getState() != Fiber::TERM
-                    && cb_fiber->getState() != Fiber::EXCEPT) {
-                        cb_fiber->setState(Fiber::HOLD);
-                    cb_fiber.reset();
+                if(fiber->getState() != Fiber::TERM
+                    && fiber->getState() != Fiber::EXCEPT) {
+                        fiber->setState(Fiber::HOLD);
+                    fiber.reset();
                 }
                 else {
-                    cb_fiber->reset(nullptr);
-                    Log_Debug(g_logger) << "scheduler cb terminated " << m_fibers.size();
+                    recordStackUsage(fiber);
+                    fiber->reset(nullptr);
                 }
             }
         }
@@ -283,10 +521,22 @@ void Scheduler::run() {
                 break;
             }
 
+            // 先登记空闲再复查队列, 与 scheduleLocal/scheduleInbox 中的检查配对, 避免漏唤醒
             ++m_idelThreadNum;
-            // startSleep();
+            self->idle = true;
+            if(hasLocalTask() || !self->inbox.empty()) {
+                self->idle = false;
+                --m_idelThreadNum;
+                continue;
+            }
+            if(m_workerLoad) {
+                self->load.startSleep();
+            }
             idle_fiber->swapIn();
-            // startWork();
+            if(m_workerLoad) {
+                self->load.startWork();
+            }
+            self->idle = false;
             --m_idelThreadNum;
             if(idle_fiber->getState() != Fiber::TERM 
                 && idle_fiber->getState() != Fiber::EXCEPT) {
@@ -294,9 +544,65 @@ void Scheduler::run() {
             }
         }
     }
+    t_worker = nullptr;
     Log_Debug(g_logger) << "scheduler run finnished";
 }
 
+void Scheduler::recordStackUsage(const Fiber::Ptr& fiber) {
+    size_t used = fiber->getStackHighWater();
+    if(!used) {
+        return;
+    }
+    size_t idx = 0;
+    while(idx + 1 < StackUsage::BUCKETS && used > (1024ul << idx)) {
+        ++idx;
+    }
+    std::lock_guard<Mutextype> lock(m_stackUsage_mtx);
+    auto& usage = m_stackUsage[std::type_index(fiber->getEntryType())];
+    ++usage.count;
+    ++usage.buckets[idx];
+    if(used > usage.max) {
+        usage.max = used;
+    }
+}
+
+std::vector<Scheduler::StackUsage> Scheduler::getStackUsage() {
+    std::vector<StackUsage> result;
+    std::lock_guard<Mutextype> lock(m_stackUsage_mtx);
+    for(auto& i : m_stackUsage) {
+        if(i.second.name.empty()) {
+            char* name = abi::__cxa_demangle(i.first.name(), nullptr, nullptr, nullptr);
+            i.second.name = name ? name : i.first.name();
+            free(name);
+        }
+        result.push_back(i.second);
+    }
+    return result;
+}
+
+std::string Scheduler::dumpStackUsage() {
+    std::stringstream ss;
+    ss << "[Scheduler " << m_name << " stack usage]" << std::endl;
+    for(auto& i : getStackUsage()) {
+        ss << "    " << i.name << std::endl
+           << "        count=" << i.count << " max=" << i.max << std::endl
+           << "        ";
+        for(size_t j = 0; j < StackUsage::BUCKETS; ++j) {
+            if(!i.buckets[j]) {
+                continue;
+            }
+            if(j + 1 < StackUsage::BUCKETS) {
+                ss << "<=" << (1 << j) << "K:" << i.buckets[j] << " ";
+            }
+            else {
+                ss << ">" << (1 << (j - 1)) << "K:" << i.buckets[j] << " ";
+            }
+        }
+        ss << std::endl;
+    }
+    return ss.str();
+}
+
 void Scheduler::idle() {
     Log_Info(g_logger) << "idle";
 }
@@ -306,10 +612,10 @@ void Scheduler::tickle() {
 }
 
 bool Scheduler::stopping() {
-    Log_Debug(g_logger) << "Scheduler::stopping " << m_autoStop << ',' << m_running << ',' << m_fibers.empty() << ',' << m_activeThreadNum;
     std::lock_guard<std::mutex> lokc(m_fibers_mtx);
+    Log_Debug(g_logger) << "Scheduler::stopping " << m_autoStop << ',' << m_running << ',' << m_fibers.empty() << ',' << m_activeThreadNum;
     return m_autoStop && !m_running
-        && m_fibers.empty() && (m_activeThreadNum == 0);
+        && m_fibers.empty() && !hasLocalTask() && !hasInboxTask() && (m_activeThreadNum == 0);
 }
 
 } // namespace sylar
@@ -3,18 +3,26 @@
 
 #include <list>
 #include <mutex>
+#include <atomic>
 #include <memory>
 #include <vector>
 #include <string>
 #include <functional>
+#include <typeindex>
+#include <unordered_map>
 
 #include "util/hook.h"
 #include "fiber/fiber.h"
+#include "fiber/future.h"
 #include "thread/thread.h"
+#include "util/WorkStealingQueue.h"
+#include "util/MPSCQueue.h"
 
 namespace sylar {
 
 class LoadCounter {
+// 工作线程各自的负载由调度器在进出 idle 时记录
+friend class Scheduler;
 public:
     using MutexType = std::shared_mutex;
     LoadCounter(size_t max_size = 10);
@@ -38,12 +46,12 @@ protected:
         uint64_t duration;
     };
 private:
-    bool m_sleeping = true;
+    std::atomic<bool> m_sleeping = {true};
     
     size_t m_max_size;
     
-    uint64_t m_last_wake;
-    uint64_t m_last_sleep;
+    std::atomic<uint64_t> m_last_wake;
+    std::atomic<uint64_t> m_last_sleep;
 
     MutexType m_mtx;
     std::list<TimeRecord> m_records;
@@ -54,6 +62,32 @@ public:
     using Ptr = std::shared_ptr<Scheduler>;
     using Mutextype = std::mutex;
     using FuncType = std::function<void()>;
+    using TaskQueue = WorkStealingQueue<FiberTask*>;
+
+    // 每个工作线程的调度状态
+    struct Worker {
+        // 在 m_workers 中的下标
+        size_t index = 0;
+        std::atomic<int> thread_id = {-1};
+        // 线程阻塞在 idle 中
+        std::atomic<bool> idle = {false};
+        // 本地任务, 可被其他线程窃取
+        TaskQueue local;
+        // 绑定到该线程的任务, 只有该线程会取
+        MPSCQueue<FiberTask> inbox;
+        // 该线程的忙闲比例, 开启 setWorkerLoadTracking 后才记录
+        LoadCounter load;
+    };
+
+    // 按入口回调汇总的协程栈使用峰值, 需开启 fiber.stack_watermark
+    struct StackUsage {
+        static constexpr size_t BUCKETS = 12;
+        std::string name;
+        uint64_t count = 0;
+        uint64_t max = 0;
+        // buckets[0] 为 <=1KB, buckets[i] 为 (2^(i-1), 2^i] KB, 最后一个桶收纳更大的
+        uint64_t buckets[BUCKETS] = {0};
+    };
 
 public:
     Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name = "test", const size_t load_size = 10);
@@ -66,27 +100,50 @@ public:
 
     void stop();
 
+    std::vector<StackUsage> getStackUsage();
+
+    std::string dumpStackUsage();
+
+    // shared_stack 为 true 时回调在线程共享栈上运行, 首次运行后固定在该线程
     template<class T>
-    void schedule(T cb, int thread = -1) {
-        bool need_tickle = false;
-        {
-            std::unique_lock<std::shared_mutex> lock(m_threads_mtx);
-            need_tickle = need_tickle | scheduleNonLock(cb, thread);
+    void schedule(T cb, int thread = -1, bool shared_stack = false) {
+        FiberTask item(cb, thread);
+        if(!item.cb && !item.fiber) {
+            return;
         }
-        if(need_tickle) {
+        item.shared_stack = shared_stack;
+        if(scheduleTask(std::move(item))) {
             tickle();
         }
     }
 
+    /**
+     * @brief 调度 fn 并返回其结果的 Future
+     * @details fn 与结果存放在同一个状态对象里, 投递的回调只捕获一个指针,
+     *          std::function 不再额外分配
+     */
+    template<class F>
+    Future<std::invoke_result_t<F> > scheduleWithResult(F fn, int thread = -1) {
+        using ResultType = std::invoke_result_t<F>;
+        auto state = new TaskState<ResultType, F>(std::move(fn));
+        state->addRef();
+        Future<ResultType> future(state);
+        schedule([state]() {
+            state->run();
+            state->release();
+        }, thread);
+        return future;
+    }
+
     template<class Iterator>
     void schedule(Iterator begin, Iterator end) {
         bool need_tickle = false;
-        {
-            std::unique_lock<std::shared_mutex> lock(m_threads_mtx);
-            while(begin != end) {
-                need_tickle = need_tickle | scheduleNonLock(&(*begin), -1);
-                ++begin;
+        while(begin != end) {
+            FiberTask item(&(*begin), -1);
+            if(item.cb || item.fiber) {
+                need_tickle = scheduleTask(std::move(item)) | need_tickle;
             }
+            ++begin;
         }
         if(need_tickle) {
             tickle();
@@ -94,17 +151,77 @@ public:
     }
 
 protected:
-    template<class T>
-    bool scheduleNonLock(T cb, int thread = -1) {
+    // 按任务绑定的线程分发到收件箱/本地队列/全局注入队列, 返回是否需要 tickle
+    bool scheduleTask(FiberTask&& item);
+
+    // 一次投递一批任务: 全局队列只加一次锁, 最多 tickle 一次; 返回后 tasks 被清空
+    void scheduleBatch(std::vector<FiberTask>& tasks);
+
+    // 全局注入队列, 调用方需持有 m_fibers_mtx
+    bool scheduleNonLock(FiberTask&& item) {
         bool need_tickle = m_fibers.empty();
-        auto item = FiberTask(cb, thread);
-        if(item.cb || item.fiber) {
-            m_fibers.emplace_back(item);
-        }
+        m_fibers.emplace_back(std::move(item));
+        ++m_fibersCount;
         return need_tickle;
     }
 
-    void run();
+    // 工作线程本地队列, 只在本调度器的工作线程上调用
+    bool scheduleLocal(FiberTask&& item) {
+        getLocalQueue()->push(new FiberTask(std::move(item)));
+        // 有线程空闲时唤醒它来窃取
+        return m_idelThreadNum > 0;
+    }
+
+    // 绑定线程的任务直接投递到该线程的收件箱
+    // 投递给自己时不需要唤醒: 线程在再次进入 idle 之前一定会检查自己的收件箱
+    bool scheduleInbox(Worker* worker, FiberTask&& item) {
+        worker->inbox.push(std::move(item));
+        return worker->idle && worker != getCurrentWorker();
+    }
+
+    // 当前线程是本调度器的工作线程时返回其本地队列, 否则返回nullptr
+    TaskQueue* getLocalQueue();
+
+    // 当前线程是本调度器的工作线程时返回它, 否则返回nullptr
+    Worker* getCurrentWorker();
+
+    // 按线程id查找工作线程, 与队列长度和线程数无关
+    Worker* getWorker(int thread);
+
+    Worker* getWorkerAt(size_t idx) { return m_workers[idx].get(); }
+
+    size_t getWorkerCount() const { return m_workers.size(); }
+
+    bool popTask(FiberTask& ft, size_t idx, bool& need_tickle);
+
+    bool hasLocalTask();
+
+    bool hasInboxTask();
+
+    bool hasPendingInbox();
+
+    // 当前线程能取到的任务: 自己的收件箱、本地队列(含可窃取的)、全局队列
+    // 线程登记睡眠之后、真正阻塞之前复查, 与 tickle 中对睡眠线程数的检查配对
+    bool hasPendingTask();
+
+    bool hasIdleThreads() { return m_idelThreadNum > 0; }
+
+    // 在 start 之前打开, 工作线程进出 idle 时更新各自的 Worker::load
+    void setWorkerLoadTracking(bool v) { m_workerLoad = v; }
+
+    // 工作线程最近的负载百分比, thread 不是本调度器的工作线程时返回-1
+    int getWorkerLoad(int thread);
+
+    // 协程结束后记录其栈使用峰值
+    void recordStackUsage(const Fiber::Ptr& fiber);
+
+    void run(size_t idx);
+
+    // 本调度器创建的线程进入 run 时调用一次, use_caller 的根线程不调用
+    virtual void onThreadStart() {}
+
+    // use_caller 时为根线程id, 否则为-1
+    int getRootThread() const { return m_rootThread; }
 
     virtual void tickle();
 
@@ -118,14 +235,18 @@ public:
     void setThis();
 
     static Fiber* getMainFiber();
+
+    // 当前线程正处于某个调度器的 run 中、且执行的不是调度协程时返回该调度器, 否则返回nullptr
+    // use_caller 的根线程在 run 之外 getThis 也非空, 此时只能阻塞线程而不能 yield
+    static Scheduler* getRunningThis();
 private:
     bool m_running = false;
     bool m_autoStop = false;
     bool m_stopping = false;
 
     size_t m_threadNum = 0;
-    size_t m_idelThreadNum = 0;
-    size_t m_activeThreadNum = 0;
+    std::atomic<size_t> m_idelThreadNum = {0};
+    std::atomic<size_t> m_activeThreadNum = {0};
 
     std::string m_name;
 
@@ -138,8 +259,22 @@ private:
     std::shared_mutex m_threads_mtx;
     std::vector<Thread::Ptr> m_threads;
 
+    // 外部线程的任务进入全局注入队列
     std::mutex m_fibers_mtx;
     std::list<FiberTask> m_fibers;
+    // m_fibers 的长度, 在锁内修改, 供 hasPendingTask 不加锁地快速判断
+    std::atomic<size_t> m_fibersCount = {0};
+
+    // 每个工作线程一个本地队列和收件箱, 空闲线程从其他线程的本地队列窃取
+    bool m_workStealing = true;
+    bool m_workerLoad = false;
+    std::vector<std::unique_ptr<Worker> > m_workers;
+    // 线程id到工作线程, start 中建好后只读
+    std::unordered_map<int, Worker*> m_workerMap;
+    std::atomic<bool> m_workerMapReady = {false};
+
+    std::mutex m_stackUsage_mtx;
+    std::unordered_map<std::type_index, StackUsage> m_stackUsage;
 };
 
 } // namespace sylar
@@ -0,0 +1,323 @@
+#ifndef _SYLAR_TASK_H_
+#define _SYLAR_TASK_H_
+
+// 无栈协程 CoTask<T>(sylar::Task 已用于线程任务), 需要 C++20 协程支持(CMake 选项 SYLAR_COROUTINE 打开 -std=c++20);
+// 以 C++17 编译时本头文件为空, 不影响其他代码。
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <errno.h>
+
+#include "fiber/future.h"
+#include "fiber/scheduler.h"
+#include "eventpoller/eventpoller.h"
+#include "socket/socket.h"
+#include "util/hook.h"
+
+#define SYLAR_HAVE_TASK 1
+
+namespace sylar {
+
+template<class T>
+class CoTask;
+
+namespace task_detail {
+
+// 结束时把控制权直接交还给 co_await 它的协程(对称转移), 不经过调度器
+struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+
+    template<class Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+        auto cont = h.promise().continuation;
+        return cont ? cont : std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+};
+
+struct PromiseBase {
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { exception = std::current_exception(); }
+
+    void rethrow() {
+        if(exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+};
+
+template<class T>
+struct TaskPromise : PromiseBase {
+    CoTask<T> get_return_object();
+
+    template<class U>
+    void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
+
+    T result() {
+        rethrow();
+        return std::move(*value);
+    }
+
+    std::optional<T> value;
+};
+
+template<>
+struct TaskPromise<void> : PromiseBase {
+    CoTask<void> get_return_object();
+
+    void return_void() {}
+
+    void result() { rethrow(); }
+};
+
+// Spawn 用的分离协程, 结束时自行销毁
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() {
+            return Detached{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+} // namespace task_detail
+
+/**
+ * @brief 无栈协程任务
+ * @details 惰性启动: 被 co_await 或交给 Spawn 后才开始执行。
+ *          协程帧只保存跨 co_await 存活的局部变量, 通常几百字节, 而 Fiber 需要一整个栈。
+ *          挂起时不占用线程, 由 EventPoller/Scheduler 在就绪后把恢复操作作为普通回调调度,
+ *          因此运行在调度器现有的工作线程上。
+ */
+template<class T = void>
+class [[nodiscard]] CoTask {
+public:
+    using promise_type = task_detail::TaskPromise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    explicit CoTask(Handle h) : m_handle(h) {}
+
+    CoTask(CoTask&& rhs) : m_handle(std::exchange(rhs.m_handle, nullptr)) {}
+
+    CoTask& operator=(CoTask&& rhs) {
+        if(this != &rhs) {
+            if(m_handle) {
+                m_handle.destroy();
+            }
+            m_handle = std::exchange(rhs.m_handle, nullptr);
+        }
+        return *this;
+    }
+
+    CoTask(const CoTask&) = delete;
+    CoTask& operator=(const CoTask&) = delete;
+
+    ~CoTask() {
+        if(m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    auto operator co_await() && noexcept {
+        struct Awaiter {
+            Handle handle;
+
+            bool await_ready() noexcept { return handle.done(); }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> cont) noexcept {
+                handle.promise().continuation = cont;
+                return handle;
+            }
+
+            T await_resume() { return handle.promise().result(); }
+        };
+        return Awaiter{m_handle};
+    }
+
+    Handle handle() const { return m_handle; }
+
+private:
+    Handle m_handle;
+};
+
+namespace task_detail {
+
+template<class T>
+inline CoTask<T> TaskPromise<T>::get_return_object() {
+    return CoTask<T>(std::coroutine_handle<TaskPromise<T> >::from_promise(*this));
+}
+
+inline CoTask<void> TaskPromise<void>::get_return_object() {
+    return CoTask<void>(std::coroutine_handle<TaskPromise<void> >::from_promise(*this));
+}
+
+// 参数按值移入协程帧, Spawn 返回后仍然有效
+template<class T>
+inline Detached RunTask(CoTask<T> task, sylar::Promise<T> p) {
+    try {
+        if constexpr (std::is_void<T>::value) {
+            co_await std::move(task);
+            p.setValue();
+        }
+        else {
+            p.setValue(co_await std::move(task));
+        }
+    }
+    catch (...) {
+        p.setException(std::current_exception());
+    }
+}
+
+} // namespace task_detail
+
+/**
+ * @brief 在 scheduler 上启动 task, 返回其结果的 Future
+ * @details Fiber 代码可以直接 get() 等待(只挂起当前协程), 实现与现有代码的互通
+ */
+template<class T>
+Future<T> Spawn(Scheduler* scheduler, CoTask<T> task, int thread = -1) {
+    Promise<T> promise;
+    Future<T> future = promise.getFuture();
+    auto h = task_detail::RunTask(std::move(task), std::move(promise)).handle;
+    scheduler->schedule([h]() { h.resume(); }, thread);
+    return future;
+}
+
+/**
+ * @brief 让出当前线程, 经调度器稍后恢复
+ */
+inline auto Yield() {
+    struct Awaiter {
+        bool await_ready() noexcept { return false; }
+
+        void await_suspend(std::coroutine_handle<> h) {
+            Scheduler::getThis()->schedule([h]() { h.resume(); });
+        }
+
+        void await_resume() noexcept {}
+    };
+    return Awaiter{};
+}
+
+/**
+ * @brief 等待 fd 可读/可写
+ * @details 通过 EventPoller::addEvent 注册回调, 就绪时由 EventPoller 调度恢复。
+ *          co_await 返回false表示注册失败; 已就绪或被 cancelEvent 取消时同样会恢复, 由调用方重试 IO 判断。
+ */
+class IoAwaiter {
+public:
+    IoAwaiter(int fd, EventPoller::Event event)
+        :m_fd(fd), m_event(event) {
+    }
+
+    bool await_ready() noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        EventPoller* ep = EventPoller::getThis();
+        int rt = ep ? ep->addEvent(m_fd, m_event, [h]() { h.resume(); }) : -1;
+        // rt > 0: 事件已经就绪, 不挂起
+        m_ok = rt >= 0;
+        return rt == 0;
+    }
+
+    bool await_resume() noexcept { return m_ok; }
+
+private:
+    int m_fd;
+    EventPoller::Event m_event;
+    bool m_ok = true;
+};
+
+inline IoAwaiter Readable(int fd) { return IoAwaiter(fd, EventPoller::READ); }
+
+inline IoAwaiter Writable(int fd) { return IoAwaiter(fd, EventPoller::WRITE); }
+
+/**
+ * @brief 等待 Future 就绪, 就绪后经当前调度器恢复
+ */
+template<class T>
+auto operator co_await(Future<T> future) {
+    struct Awaiter {
+        Future<T> future;
+
+        bool await_ready() { return future.isReady(); }
+
+        void await_suspend(std::coroutine_handle<> h) {
+            Scheduler* scheduler = Scheduler::getThis();
+            future.onReady([scheduler, h]() {
+                if(scheduler) {
+                    scheduler->schedule([h]() { h.resume(); });
+                }
+                else {
+                    h.resume();
+                }
+            });
+        }
+
+        T await_resume() { return future.get(); }
+    };
+    return Awaiter{std::move(future)};
+}
+
+/**
+ * @brief 非阻塞地读, 没有数据时挂起协程
+ * @attention fd 需为非阻塞(hook 创建的 socket 在系统层面已是非阻塞), 这里直接调用原始 recv
+ */
+inline CoTask<ssize_t> AsyncRecv(int fd, void* buffer, size_t length, int flags = 0) {
+    while(true) {
+        ssize_t n = recv_f(fd, buffer, length, flags);
+        if(n >= 0) {
+            co_return n;
+        }
+        if(errno == EINTR) {
+            continue;
+        }
+        if(errno != EAGAIN || !co_await Readable(fd)) {
+            co_return -1;
+        }
+    }
+}
+
+inline CoTask<ssize_t> AsyncSend(int fd, const void* buffer, size_t length, int flags = 0) {
+    while(true) {
+        ssize_t n = send_f(fd, buffer, length, flags);
+        if(n >= 0) {
+            co_return n;
+        }
+        if(errno == EINTR) {
+            continue;
+        }
+        if(errno != EAGAIN || !co_await Writable(fd)) {
+            co_return -1;
+        }
+    }
+}
+
+inline CoTask<ssize_t> AsyncRecv(Socket::Ptr sock, void* buffer, size_t length, int flags = 0) {
+    return AsyncRecv(sock->getSock(), buffer, length, flags);
+}
+
+inline CoTask<ssize_t> AsyncSend(Socket::Ptr sock, const void* buffer, size_t length, int flags = 0) {
+    return AsyncSend(sock->getSock(), buffer, length, flags);
+}
+
+} // namespace sylar
+
+#endif // __cpp_impl_coroutine
+
+#endif //_SYLAR_TASK_H_
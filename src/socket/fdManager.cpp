@@ -15,7 +15,10 @@ namespace sylar {
     ,m_fd(fd)
     ,m_recvTimeout(-1)
     ,m_sendTimeout(-1) {
-    init();
+    m_event.fd = fd;
+    m_timeouts[0].fd = m_timeouts[1].fd = fd;
+    m_timeouts[0].event = EventPoller::READ;
+    m_timeouts[1].event = EventPoller::WRITE;
 }
 
 FdCtx::~FdCtx() {
@@ -68,43 +71,77 @@ uint64_t FdCtx::getTimeout(int type) {
     }
 }
 
+void FdCtx::armTimeout(EventPoller* ep, EventPoller::Event event, uint64_t ms) {
+    IoTimeout* t = &timeoutOf(event);
+    uint64_t armed = t->state.load(std::memory_order_relaxed);
+    t->poller.store(ep, std::memory_order_relaxed);
+    ep->addTimer(t->timer, ms, [t, armed]() {
+        uint64_t expect = armed;
+        if(t->state.compare_exchange_strong(expect, armed | 1, std::memory_order_acq_rel)) {
+            t->poller.load(std::memory_order_relaxed)->cancelEvent(t->fd, t->event);
+        }
+    });
+}
+
+bool FdCtx::disarmTimeout(EventPoller::Event event) {
+    IoTimeout& t = timeoutOf(event);
+    t.timer.cancel();
+    uint64_t state = t.state.load(std::memory_order_acquire);
+    while(!t.state.compare_exchange_weak(state, ((state >> 1) + 1) << 1, std::memory_order_acq_rel)) {
+    }
+    return state & 1;
+}
+
+void FdCtx::dropRegistration() {
+    std::lock_guard<EventPoller::FdContext::MutexType> lock(m_event.mutex);
+    m_event.registered = false;
+    m_event.ready = EventPoller::NONE;
+    m_event.loop = -1;
+    if(!m_event.events && !m_event.asyncOps) {
+        m_event.owner = 0;
+    }
+}
+
 FdManager::FdManager() {
-    m_datas.resize(64);
 }
 
-FdCtx::Ptr FdManager::get(int fd, bool auto_create) {
-    if(fd == -1) {
+FdCtx* FdManager::getRecord(int fd, bool create) {
+    if(fd < 0) {
         return nullptr;
     }
-    {
-        std::shared_lock<Mutex> lock(m_mtx);
-        if((int)m_datas.size() <= fd) {
-            if(auto_create == false) {
-                return nullptr;
-            }
-        } else {
-            if(m_datas[fd] || !auto_create) {
-                return m_datas[fd];
-            }
-        }
+    if(!create) {
+        return m_datas.get(fd);
     }
+    return m_datas.getOrCreate(fd, [](size_t idx) {
+        return new FdCtx(idx);
+    });
+}
 
-    {   
-        std::unique_lock<Mutex> lock(m_mtx);
-        FdCtx::Ptr ctx(new FdCtx(fd));
-        if(fd >= (int)m_datas.size()) {
-            m_datas.resize(fd * 1.5);
-        }
-        m_datas[fd] = ctx;
+FdCtx* FdManager::get(int fd, bool auto_create) {
+    FdCtx* ctx = getRecord(fd, auto_create);
+    if(!ctx) {
+        return nullptr;
+    }
+    if(ctx->isValid()) {
         return ctx;
     }
+    if(!auto_create) {
+        return nullptr;
+    }
+    // 新打开的 fd 只有拿到它的线程会登记, 不会与同一个 fd 的 del 并发
+    // 上一个同号 fd 可能没有经过钩子就被关闭, 它留下的注册状态不能沿用
+    ctx->dropRegistration();
+    ctx->m_isInit = false;
+    ctx->init();
+    ctx->m_valid.store(true, std::memory_order_release);
+    return ctx;
 }
 
 void FdManager::del(int fd) {
-    std::unique_lock<Mutex> lock(m_mtx);
-    if((int)m_datas.size() <= fd) {
-        return;
+    FdCtx* ctx = getRecord(fd, false);
+    if(ctx) {
+        ctx->m_valid.store(false, std::memory_order_release);
+        ctx->dropRegistration();
     }
-    m_datas[fd].reset();
 }
 } // namespace sylar
@@ -1,18 +1,25 @@
 #ifndef _SYLAR_FD_MANAGER_H_
 #define _SYLAR_FD_MANAGER_H_
 
+#include <atomic>
 #include <memory>
-#include <vector>
-#include <shared_mutex>
 #include "thread/thread.h"
+#include "eventpoller/eventpoller.h"
 #include "util/Singleton.h"
+#include "util/SegmentedTable.h"
 
 namespace sylar {
 
-class FdCtx : public std::enable_shared_from_this<FdCtx> {
+/**
+ * @brief 每个 fd 一条记录: 钩子层的阻塞属性、超时与 EventPoller 的等待状态放在一起
+ * @details 记录按缓存行对齐, 相邻 fd 的记录不会伪共享。
+ *          记录创建后地址不变, fd 关闭后保留, 下次同号 fd 打开时复用;
+ *          钩子层是否接管由 isValid 区分, EventPoller 的状态不受其影响。
+ */
+class alignas(64) FdCtx : public noncopyable {
+friend class FdManager;
+friend class EventPoller;
 public:
-    using Ptr = std::shared_ptr<FdCtx>;
-
     FdCtx(int fd);
 
     ~FdCtx();
@@ -35,10 +42,40 @@ public:
 
     uint64_t getTimeout(int type);
 
+    // fd 打开着且经过钩子登记
+    bool isValid() const { return m_valid.load(std::memory_order_acquire); }
+
+    /**
+     * @brief 为本 fd 上 event 方向的一次阻塞等待设置超时, 到期时在 ep 上取消该等待
+     * @details 定时器嵌在记录中, 回调只捕获超时项的指针和序号, 设置、取消都不分配内存
+     */
+    void armTimeout(EventPoller* ep, EventPoller::Event event, uint64_t ms);
+
+    // 撤销 armTimeout 设置的超时, 返回等待是否因超时而结束
+    bool disarmTimeout(EventPoller::Event event);
+
 private:
     bool init();
 
+    // 内核在 close 时已移除 epoll 注册, 作废记录里缓存的注册状态; 没有等待者时一并清除所属实例
+    void dropRegistration();
+
+    // 每个方向同时只有一个协程在等, 各有一个超时项
+    struct IoTimeout {
+        Timer timer;
+        std::atomic<EventPoller*> poller = {nullptr};
+        // 序号 << 1 | 是否已超时; 每次撤销都换新序号, 已取出但未执行的过期回调据此失效
+        std::atomic<uint64_t> state = {0};
+        int fd = -1;
+        EventPoller::Event event = EventPoller::NONE;
+    };
+
+    IoTimeout& timeoutOf(EventPoller::Event event) {
+        return m_timeouts[event == EventPoller::READ ? 0 : 1];
+    }
+
 private:
+    std::atomic<bool> m_valid = {false};
     bool m_isInit: 1;
     bool m_isSocket: 1;
     bool m_sysNonblock: 1;
@@ -47,20 +84,29 @@ private:
     int m_fd;
     uint64_t m_recvTimeout;
     uint64_t m_sendTimeout;
+    // EventPoller 的等待状态, 只由 EventPoller 在 m_event.mutex 下访问
+    EventPoller::FdContext m_event;
+    IoTimeout m_timeouts[2];
 };
 
 class FdManager {
 public:
-    using Mutex = std::shared_mutex;
-
     FdManager();
 
-    FdCtx::Ptr get(int fd, bool auto_create = false);
+    /**
+     * @brief 取钩子登记过的 fd 记录, 查找无锁
+     * @param[in] auto_create 未登记时登记(检查是否 socket 并设为系统非阻塞)
+     */
+    FdCtx* get(int fd, bool auto_create = false);
 
+    // close 时调用(钩子关闭时也调用): 记录保留, 只是不再视为已登记, 缓存的 epoll 注册状态作废
     void del(int fd);
+
+    // 不论钩子是否登记都返回 fd 的记录, create 为 false 且还没有记录时返回nullptr; 供 EventPoller 使用
+    FdCtx* getRecord(int fd, bool create);
+
 private:
-    Mutex m_mtx;
-    std::vector<FdCtx::Ptr> m_datas;
+    SegmentedTable<FdCtx> m_datas;
 };
 
 typedef Singleton<FdManager> FdMgr;
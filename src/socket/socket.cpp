@@ -128,7 +128,7 @@ bool Socket::init(int sock) {
 
 void Socket::newSock() {
     m_sock = socket(m_family, m_type, m_protocol);
-    if(UNLIKELY(m_sock == -1)) {
+    if(LIKELY(m_sock != -1)) {
         initSock();
     }
     else {
@@ -1,5 +1,6 @@
 #ifndef _SYLAR_MUTEX_H
 #define _SYLAR_MUTEX_H
+#include <errno.h>
 #include <stdint.h>
 #include <shared_mutex>
 #include <semaphore.h>
@@ -39,7 +40,8 @@ public:
      * @brief 获取信号量
      */
     void wait() {
-        sem_wait(&m_sem);
+        // io_uring 的完成通知可能让阻塞中的 sem_wait 以 EINTR 返回
+        while(sem_wait(&m_sem) && errno == EINTR);
     }
 
     /**
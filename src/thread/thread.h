@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <thread>
+#include <functional>
 #include <pthread.h>
 
 #include "util/util.h"
@@ -1,118 +1,414 @@
 #include "timer/timer.h"
 #include "util/util.h"
 #include "log/logger.h"
+#include "config/config.h"
+
+#include <string.h>
+#include <algorithm>
+#include <thread>
 
 namespace sylar {
 static Logger::Ptr g_logger = Name_Logger("system");
 
-bool Timer::Comparator::operator()(const Timer::Ptr& lhs, const Timer::Ptr& rhs) const{
-    if(!lhs && !rhs) {
+static ConfigVar<uint32_t>::ptr g_timer_slack_ms =
+    Config::Lookup<uint32_t>("timer.slack_ms", 100, "max slack of timers without an explicit one, actual slack is 1/64 of the timeout; 0 disables coalescing");
+
+Timer::Timer(uint64_t us, std::function<void()> cb,
+            bool recurring, TimerManager* manager)
+            : m_recurring(recurring), m_us(us), m_manager(manager) {
+    m_cb = std::forward<std::function<void()>>(cb);
+    m_next = getTimeUsec() + us;
+}
+
+int Timer::waitStable() const {
+    int state;
+    while((state = m_state.load(std::memory_order_acquire)) == FIRING) {
+        std::this_thread::yield();
+    }
+    return state;
+}
+
+bool Timer::cancel() {
+    if(!m_manager) {
         return false;
     }
-    if(!lhs) {
+    int state = waitStable();
+    while(state == ARMED
+            && !m_state.compare_exchange_weak(state, IDLE, std::memory_order_acq_rel)) {
+        if(state == FIRING) {
+            state = waitStable();
+        }
+    }
+    if(state != ARMED) {
+        return false;
+    }
+    // 所属线程不会再读取回调, 在本线程释放
+    Func cb;
+    cb.swap(m_cb);
+    m_manager->countArmed(-1);
+    // 其他线程上不投递, 所属线程走到它的槽时再摘下
+    m_manager->update(this, false);
+    return true;
+}
+
+bool Timer::refresh() {
+    if(!m_manager || waitStable() != ARMED) {
         return false;
     }
-    if(!rhs) {
+    m_next = sylar::getTimeUsec() + m_us;
+    m_manager->update(this, false);
+    return true;
+}
+
+bool Timer::reset(uint64_t ms, bool from_now) {
+    uint64_t us = ms * 1000;
+    if(us == m_us && !from_now) {
         return true;
     }
-    if(lhs->m_next != rhs->m_next) {
-        return (lhs->m_next < rhs->m_next);
+    if(!m_manager || waitStable() != ARMED) {
+        return false;
     }
-    else {
-        return (lhs.get() < rhs.get());
+    uint64_t old = m_next;
+    uint64_t start = 0;
+    if(from_now) {
+        start = sylar::getTimeUsec();
+    } else {
+        start = old - m_us;
     }
+    m_us = us;
+    m_next = start + us;
+    m_manager->update(this, m_next < old);
+    return true;
 }
 
-Timer::Timer(uint64_t ms, std::function<void()> cb, 
-            bool recurring, TimerManager* manager)
-            : m_ms(ms), m_recurring(recurring), m_manager(manager) {
-    m_cb = std::forward<std::function<void()>>(cb);
-    m_next = getCurrentMS() + ms;
+TimerManager::Wheel::Wheel() {
+    current = getTimeUsec();
+    memset(root, 0, sizeof(root));
+    memset(levels, 0, sizeof(levels));
+    memset(rootBitmap, 0, sizeof(rootBitmap));
+    memset(levelBitmap, 0, sizeof(levelBitmap));
 }
 
-Timer::Timer(uint64_t next)
-    :m_next(next) {
+Timer*& TimerManager::Wheel::slotHead(int level, int slot) {
+    return level == 0 ? root[slot] : levels[level - 1][slot];
 }
 
-bool Timer::cancel() {
-    std::unique_lock<TimerManager::Mutex> lock(m_manager->m_mtx);
-    if(m_cb) {
-        m_cb = nullptr;
-        auto it = m_manager->m_timers.find(shared_from_this());
-        if(it != m_manager->m_timers.end()) {
-            m_manager->m_timers.erase(it);
+static inline int LevelShift(int level) {
+    return level == 0 ? 0 : 8 + 6 * (level - 1);
+}
+
+// 在 [next, next + slack] 内取对齐到 2^k(不超过 slack 的最大2的幂)的时刻, 相近的到期时间落到同一个点上
+static inline uint64_t Coalesce(uint64_t next, uint64_t slack) {
+    if(slack == 0) {
+        return next;
+    }
+    uint64_t align = 1ull << (63 - __builtin_clzll(slack));
+    return (next + slack) & ~(align - 1);
+}
+
+void TimerManager::Wheel::link(Timer* timer) {
+    uint64_t next = timer->m_next.load(std::memory_order_relaxed);
+    if(count == 0) {
+        // 空闲期间时间轮不走, 以定时器的起算时刻追上当前时间, 避免之后逐槽补走
+        current = std::max(current, next - timer->m_us.load(std::memory_order_relaxed));
+    }
+    uint64_t expires = std::max(Coalesce(next, timer->m_slack.load(std::memory_order_relaxed)), current);
+    uint64_t delta = expires - current;
+    int level = 0;
+    if(delta >= ROOT_SIZE) {
+        if(delta > MAX_SPAN) {
+            // 超出时间轮范围, 先放在最高层最远的槽, 降层时按实际到期时间重新放置
+            delta = MAX_SPAN;
+            expires = current + MAX_SPAN;
         }
-        return true;
+        level = 1;
+        while(level < LEVELS - 1 && delta >= (1ull << LevelShift(level + 1))) {
+            ++level;
+        }
+    }
+    int slot = level == 0 ? (expires & (ROOT_SIZE - 1))
+                          : ((expires >> LevelShift(level)) & (LEVEL_SIZE - 1));
+
+    Timer*& head = slotHead(level, slot);
+    timer->m_prev = nullptr;
+    timer->m_succ = head;
+    if(head) {
+        head->m_prev = timer;
     }
-    return false;
+    head = timer;
+    timer->m_level = level;
+    timer->m_slot = slot;
+    if(level == 0) {
+        rootBitmap[slot / 64] |= 1ull << (slot % 64);
+    } else {
+        levelBitmap[level - 1] |= 1ull << slot;
+    }
+    if(!timer->m_self) {
+        // 嵌入式定时器没有 shared_ptr 持有, 得到空指针
+        timer->m_self = timer->weak_from_this().lock();
+    }
+    ++count;
 }
 
-bool Timer::refresh() {
-    {
-        std::shared_lock<TimerManager::Mutex> lock(m_manager->m_mtx);
-        if(!m_cb) {
-            return false;
+void TimerManager::Wheel::unlink(Timer* timer) {
+    int level = timer->m_level;
+    int slot = timer->m_slot;
+    if(timer->m_prev) {
+        timer->m_prev->m_succ = timer->m_succ;
+    } else {
+        slotHead(level, slot) = timer->m_succ;
+    }
+    if(timer->m_succ) {
+        timer->m_succ->m_prev = timer->m_prev;
+    }
+    timer->m_prev = timer->m_succ = nullptr;
+    timer->m_level = -1;
+    if(!slotHead(level, slot)) {
+        if(level == 0) {
+            rootBitmap[slot / 64] &= ~(1ull << (slot % 64));
+        } else {
+            levelBitmap[level - 1] &= ~(1ull << slot);
         }
     }
-    {
-        std::unique_lock<TimerManager::Mutex> lock(m_manager->m_mtx);
-        auto it = m_manager->m_timers.find(shared_from_this());
-        if(it != m_manager->m_timers.end()) {
-            return false;
+    --count;
+}
+
+bool TimerManager::Wheel::cascade(int level) {
+    int slot = (current >> LevelShift(level)) & (LEVEL_SIZE - 1);
+    Timer* timer = levels[level - 1][slot];
+    levels[level - 1][slot] = nullptr;
+    levelBitmap[level - 1] &= ~(1ull << slot);
+    while(timer) {
+        Timer* succ = timer->m_succ;
+        --count;
+        link(timer);
+        timer = succ;
+    }
+    return slot == 0;
+}
+
+// bits 中下标不小于 from 的第一个置位, 没有时返回-1
+static int FindFirstSet(const uint64_t* bits, int words, int from) {
+    for(int w = from / 64; w < words; ++w) {
+        uint64_t v = bits[w];
+        if(w == from / 64) {
+            v &= ~0ull << (from % 64);
+        }
+        if(v) {
+            return w * 64 + __builtin_ctzll(v);
         }
-        m_manager->m_timers.erase(it);
-        m_next = sylar::getCurrentMS() + m_ms;
-        m_manager->m_timers.insert(shared_from_this());
-        return true;
     }
+    return -1;
 }
 
-bool Timer::reset(uint64_t ms, bool from_now) {
-    if(ms == m_ms && !from_now) {
-        return true;
+uint64_t TimerManager::Wheel::firstSlotTime(int level) const {
+    if(level == 0) {
+        int pos = current & (ROOT_SIZE - 1);
+        int p = FindFirstSet(rootBitmap, ROOT_SIZE / 64, pos);
+        if(p < 0) {
+            p = FindFirstSet(rootBitmap, ROOT_SIZE / 64, 0);
+            if(p < 0) {
+                return ~0ull;
+            }
+            p += ROOT_SIZE;
+        }
+        return current + (p - pos);
     }
-    std::unique_lock<TimerManager::Mutex> lock(m_manager->m_mtx);
-    if(!m_cb) {
-        return false;
+
+    int shift = LevelShift(level);
+    uint64_t bits = levelBitmap[level - 1];
+    if(!bits) {
+        return ~0ull;
+    }
+    int cur = (current >> shift) & (LEVEL_SIZE - 1);
+    int p = FindFirstSet(&bits, 1, cur);
+    if(p < 0) {
+        p = FindFirstSet(&bits, 1, 0) + LEVEL_SIZE;
+    }
+    uint64_t d = p - cur;
+    if(d == 0) {
+        // 当前槽: 低位全为0时正等着降层, 否则是下一圈的
+        uint64_t mask = (1ull << shift) - 1;
+        return (current & mask) == 0 ? current
+                : ((current >> shift) + LEVEL_SIZE) << shift;
+    }
+    return ((current >> shift) + d) << shift;
+}
+
+uint64_t TimerManager::Wheel::nextExpire() const {
+    uint64_t next = firstSlotTime(0);
+    // 高层的槽都不早于第0层的下一圈起点, 第0层本圈有定时器时不必再看高层
+    uint64_t round_end = ((current >> ROOT_BITS) + 1) << ROOT_BITS;
+    if((current & (ROOT_SIZE - 1)) == 0 || next >= round_end) {
+        for(int level = 1; level < LEVELS; ++level) {
+            next = std::min(next, firstSlotTime(level));
+        }
+    }
+    return next;
+}
+
+TimerManager::TimerManager() {
+    m_maxSlack = g_timer_slack_ms->getValue() * 1000ull;
+    setTimerShards(1);
+}
+
+TimerManager::~TimerManager() {
+    // 解开时间轮中定时器的自引用; 使用方仍持有的 Timer::Ptr 不受影响
+    std::vector<Timer::Ptr> timers;
+    for(auto& wheel : m_wheels) {
+        for(int level = 0; level < LEVELS; ++level) {
+            int slots = level == 0 ? ROOT_SIZE : LEVEL_SIZE;
+            for(int slot = 0; slot < slots; ++slot) {
+                Timer* timer = wheel->slotHead(level, slot);
+                while(timer) {
+                    Timer* succ = timer->m_succ;
+                    timer->m_prev = timer->m_succ = nullptr;
+                    timer->m_level = -1;
+                    timer->m_shard = -1;
+                    timers.emplace_back(std::move(timer->m_self));
+                    timer = succ;
+                }
+                wheel->slotHead(level, slot) = nullptr;
+            }
+        }
+    }
+}
+
+void TimerManager::setTimerShards(size_t n) {
+    m_wheels.clear();
+    for(size_t i = 0; i < n; ++i) {
+        m_wheels.emplace_back(new Wheel);
     }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it == m_manager->m_timers.end()) {
+}
+
+Timer::Ptr TimerManager::drop(Wheel& wheel, Timer* timer) {
+    wheel.unlink(timer);
+    Timer::Ptr self = std::move(timer->m_self);
+    timer->m_shard.store(-1, std::memory_order_seq_cst);
+    return self;
+}
+
+bool TimerManager::reclaim(size_t shard, Timer* timer) {
+    // addTimer(Timer&) 先置 ARMED 再读 m_shard, 这里先解除认领再读状态, 两边至少有一边看到对方的写入:
+    // 那边看到-1时自行挂入, 看到本分片时由这里挂入, 二者以 CAS 认领, 只有一方成功
+    if(timer->m_state.load(std::memory_order_seq_cst) != Timer::ARMED) {
         return false;
     }
-    m_manager->m_timers.erase(it);
-    uint64_t start = 0;
-    if(from_now) {
-        start = sylar::getCurrentMS();
-    } else {
-        start = m_next - m_ms;
+    int linked = -1;
+    return timer->m_shard.compare_exchange_strong(linked, shard, std::memory_order_acq_rel);
+}
+
+void TimerManager::reconcile(size_t shard, Timer* timer) {
+    Wheel& wheel = *m_wheels[shard];
+    Timer::Ptr released;
+    int linked = timer->m_shard.load(std::memory_order_acquire);
+    if(linked >= 0 && (size_t)linked != shard) {
+        // 已由别的分片认领, 之后的改动都投递给它
+        return;
+    }
+    if(timer->waitStable() == Timer::ARMED) {
+        if(linked >= 0) {
+            wheel.unlink(timer);
+            wheel.link(timer);
+        } else if(timer->m_shard.compare_exchange_strong(linked, shard, std::memory_order_acq_rel)) {
+            wheel.link(timer);
+        }
+    } else if(linked >= 0) {
+        released = drop(wheel, timer);
+        if(reclaim(shard, timer)) {
+            wheel.link(timer);
+        }
     }
-    m_ms = ms;
-    m_next = start + m_ms;
-    
-    return true;
 }
 
-Timer::Ptr TimerManager::addTimer(uint64_t ms, Func cb, bool recurring) {
-    Timer::Ptr timer(new Timer(ms, cb, recurring, this));
-    bool at_front;
-    {
-        std::shared_lock<Mutex> lock(m_mtx);
-        auto it = m_timers.insert(timer).first;
-        at_front = (it == m_timers.begin());
+void TimerManager::post(size_t shard, Timer* timer) {
+    // 投递途中保证 timer 存活; 嵌入式定时器由其宿主保证
+    Timer::Ptr self = timer->weak_from_this().lock();
+    postToTimerShard(shard, [this, shard, timer, self]() {
+        reconcile(shard, timer);
+    });
+}
+
+void TimerManager::arm(Timer* timer, bool later) {
+    int shard = currentTimerShard();
+    // 与所属线程摘下已取消的定时器相对, 见 reclaim
+    int linked = timer->m_shard.load(std::memory_order_seq_cst);
+    if(shard >= 0 && (linked < 0 || linked == shard)) {
+        reconcile(shard, timer);
+        return;
+    }
+    if(linked >= 0 && later) {
+        return;
+    }
+    post(linked >= 0 ? linked : m_nextShard++ % m_wheels.size(), timer);
+}
+
+void TimerManager::update(Timer* timer, bool notify) {
+    int linked = timer->m_shard.load(std::memory_order_acquire);
+    if(linked < 0) {
+        // 还在投递途中, 所属线程挂入时按最新的状态处理
+        return;
     }
-    if(at_front) {
-        flushTimer();
+    if(linked == currentTimerShard()) {
+        reconcile(linked, timer);
+    } else if(notify) {
+        post(linked, timer);
     }
+}
+
+void TimerManager::countArmed(int64_t delta) {
+    int shard = currentTimerShard();
+    m_wheels[shard < 0 ? 0 : shard]->armed.fetch_add(delta, std::memory_order_relaxed);
+}
+
+Timer::Ptr TimerManager::addTimer(uint64_t ms, Func cb, bool recurring) {
+    return addTimerUs(ms * 1000, std::move(cb), recurring);
+}
+
+Timer::Ptr TimerManager::addTimerUs(uint64_t us, Func cb, bool recurring, uint64_t slack_us) {
+    Timer::Ptr timer(new Timer(us, std::move(cb), recurring, this));
+    timer->m_slack = slackFor(us, slack_us);
+    timer->m_state.store(Timer::ARMED, std::memory_order_release);
+    countArmed(1);
+    arm(timer.get());
     return timer;
 }
 
-void TimerManager::addTimer(Timer::Ptr val, Mutex& lock) {
-    auto it = m_timers.insert(val).first;
-    bool at_front = (it == m_timers.begin());
-    lock.unlock();
-    if(at_front) {
-        flushTimer();
+void TimerManager::addTimer(Timer& timer, uint64_t ms, Func cb) {
+    // 上一次设置在别的管理器中且取消后还没摘下, 让那边的所属线程摘下并等它完成
+    if(timer.m_manager && timer.m_manager != this
+            && timer.m_shard.load(std::memory_order_acquire) >= 0) {
+        timer.m_manager->update(&timer, true);
+        while(timer.m_shard.load(std::memory_order_acquire) >= 0) {
+            std::this_thread::yield();
+        }
     }
+    timer.waitStable();
+    // 仍挂在原分片时, 原分片会在上一次的到期时刻之前看到它; 新的到期时间和松弛都不更早就不必投递,
+    // 原分片届时按新的到期时间重新放置
+    uint64_t prev_next = timer.m_next.load(std::memory_order_relaxed);
+    uint64_t prev_slack = timer.m_slack.load(std::memory_order_relaxed);
+    bool same = timer.m_manager == this;
+    uint64_t us = ms * 1000;
+    uint64_t next = getTimeUsec() + us;
+    uint64_t slack = slackFor(us, DEFAULT_SLACK);
+    timer.m_manager = this;
+    timer.m_recurring = false;
+    timer.m_us.store(us, std::memory_order_relaxed);
+    timer.m_next.store(next, std::memory_order_relaxed);
+    timer.m_slack.store(slack, std::memory_order_relaxed);
+    timer.m_cb = std::move(cb);
+    // 与 reclaim 相对, 先置 ARMED 再由 arm 读 m_shard
+    timer.m_state.store(Timer::ARMED, std::memory_order_seq_cst);
+    countArmed(1);
+    arm(&timer, same && next >= prev_next && slack >= prev_slack);
+}
+
+uint64_t TimerManager::slackFor(uint64_t us, uint64_t slack_us) const {
+    if(slack_us != DEFAULT_SLACK) {
+        return slack_us;
+    }
+    return std::min(us / 64, m_maxSlack);
 }
 
 static void TimerCondCheck(std::weak_ptr<void> cond, std::function<void()> cb) {
@@ -129,15 +425,24 @@ Timer::Ptr TimerManager::addConditionTimer(uint64_t ms, Func cb, std::weak_ptr<v
 }
 
 uint64_t TimerManager::getNextTimer() {
-    std::shared_lock<Mutex> lock(m_mtx);
-    m_tickled = false;
-    if(m_timers.empty()) {
-        return 0;
+    uint64_t us = getNextTimerUs();
+    return us == ~0ull ? us : (us + 999) / 1000;
+}
+
+uint64_t TimerManager::getNextTimerUs() {
+    int shard = currentTimerShard();
+    if(shard < 0) {
+        return ~0ull;
+    }
+    Wheel& wheel = *m_wheels[shard];
+    if(wheel.count == 0) {
+        return ~0ull;
     }
-    const auto nxt = *m_timers.begin();
-    auto cur_ms = getCurrentMS();
-    if(nxt->m_next >= cur_ms) {
-        return nxt->m_next - cur_ms;
+    // 高层给出的是槽的起点, 可能早于其中定时器的实际到期时间, 届时醒来降层后再算
+    uint64_t next = wheel.nextExpire();
+    auto cur_us = getTimeUsec();
+    if(next >= cur_us) {
+        return next - cur_us;
     }
     else {
         return 0;
@@ -145,32 +450,82 @@ uint64_t TimerManager::getNextTimer() {
 }
 
 void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
-    auto cur_ms = getCurrentMS();
+    int shard = currentTimerShard();
+    if(shard < 0) {
+        return;
+    }
+    Wheel& wheel = *m_wheels[shard];
+    auto cur_us = getTimeUsec();
+    if(wheel.count == 0 || wheel.current > cur_us) {
+        return;
+    }
+    // 到期的一次性定时器在最后释放
     std::vector<Timer::Ptr> expired;
-    {
-        std::shared_lock<Mutex> lock(m_mtx);
-        if(m_timers.empty()) {
-            return;
+    std::vector<Timer*> recurring;
+    // 已取消又被其他线程重新设置的, 和周期定时器一样在最后放回
+    std::vector<Timer*> rearmed;
+    while(wheel.current <= cur_us) {
+        if(wheel.count == 0) {
+            wheel.current = cur_us + 1;
+            break;
         }
-    }
-    std::unique_lock<Mutex> lock(m_mtx);
-    Timer::Ptr cur_timer(new Timer(cur_ms));
-    auto it = m_timers.lower_bound(cur_timer);
-    while(it != m_timers.end() && (*it)->m_next == cur_ms) {
-        ++it;
-    }
-    expired.insert(expired.begin(), m_timers.begin(), it);
-    m_timers.erase(m_timers.begin(), it);
-    cbs.reserve(expired.size());
-    for(auto & timer : expired) {
-        cbs.emplace_back(timer->m_cb);
-        if(timer->m_recurring) {
-            timer->m_next = cur_ms + timer->m_ms;
-            m_timers.insert(timer);
+        int slot = wheel.current & (ROOT_SIZE - 1);
+        if(slot == 0) {
+            for(int level = 1; level < LEVELS && wheel.cascade(level); ++level);
         }
-        else {
-            timer->m_cb = nullptr;
+
+        Timer* timer = wheel.root[slot];
+        while(timer) {
+            Timer* succ = timer->m_succ;
+            int state = timer->m_state.load(std::memory_order_acquire);
+            if(state == Timer::ARMED && timer->m_next.load(std::memory_order_relaxed) > cur_us) {
+                // 其他线程推迟了到期时间, 到这里才调整位置
+                wheel.unlink(timer);
+                wheel.link(timer);
+            }
+            else if(state == Timer::ARMED
+                    && timer->m_state.compare_exchange_strong(state, Timer::FIRING, std::memory_order_acq_rel)) {
+                if(timer->m_recurring) {
+                    cbs.emplace_back(timer->m_cb);
+                    wheel.unlink(timer);
+                    recurring.push_back(timer);
+                }
+                else {
+                    cbs.emplace_back(std::move(timer->m_cb));
+                    timer->m_cb = nullptr;
+                    Timer::Ptr self = drop(wheel, timer);
+                    wheel.armed.fetch_sub(1, std::memory_order_relaxed);
+                    timer->m_state.store(Timer::IDLE, std::memory_order_release);
+                    if(self) {
+                        expired.emplace_back(std::move(self));
+                    }
+                }
+            }
+            else {
+                // 已被其他线程取消
+                Timer::Ptr self = drop(wheel, timer);
+                if(reclaim(shard, timer)) {
+                    rearmed.push_back(timer);
+                }
+                if(self) {
+                    expired.emplace_back(std::move(self));
+                }
+            }
+            timer = succ;
         }
+
+        // 直接跳到下一个非空槽或降层点, 不越过当前时间; 1us 一槽时逐槽走代价太高
+        ++wheel.current;
+        wheel.current = std::min(wheel.nextExpire(), cur_us + 1);
+    }
+    // 周期定时器在时间轮走过当前时刻之后再放回, 周期为0时也不会在本轮重复触发
+    for(auto timer : recurring) {
+        timer->m_next = cur_us + timer->m_us;
+        wheel.link(timer);
+        timer->m_state.store(Timer::ARMED, std::memory_order_release);
+    }
+    for(auto timer : rearmed) {
+        wheel.link(timer);
     }
 }
 
@@ -185,8 +540,12 @@ bool TimerManager::detectClockRollover(uint64_t now_ms) {
 }
 
 bool TimerManager::hasTimer() {
-    std::shared_lock<Mutex> lock(m_mtx);
-    return (m_timers.empty() == false);
+    // 设置和取消可能记在不同的分片上, 只有总和有意义
+    int64_t armed = 0;
+    for(auto& wheel : m_wheels) {
+        armed += wheel->armed.load(std::memory_order_relaxed);
+    }
+    return armed > 0;
 }
 
 } // namespace sylar
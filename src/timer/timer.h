@@ -1,10 +1,9 @@
 #ifndef _SYLAR_TIMER_H_
 #define _SYLAR_TIMER_H_
 
-#include <set>
+#include <atomic>
 #include <memory>
-#include <shared_mutex>
-#include <mutex>
+#include <vector>
 #include <functional>
 
 namespace sylar {
@@ -17,64 +16,202 @@ public:
     using Func = std::function<void()>;
 
 private:
-    Timer(uint64_t ms, Func cb, bool recurring, TimerManager* manager);
-    Timer(uint64_t ms);
+    Timer(uint64_t us, Func cb, bool recurring, TimerManager* manager);
 
 public:
+    // 嵌在其他对象中使用的定时器, 由 TimerManager::addTimer(Timer&, ...) 设置, 不归时间轮持有
+    Timer() = default;
+
+    // 可在任意线程调用, 返回 true 之后回调不会再被取出
     bool cancel();
 
     bool refresh();
 
+    // ms 为新的周期(毫秒)
     bool reset(uint64_t ms, bool from_now);
 
+private:
+    enum State {
+        // 未设置, 或已触发、已取消
+        IDLE    = 0,
+        ARMED   = 1,
+        // 所属线程正在取出回调, 其他线程需等它结束
+        FIRING  = 2,
+    };
+
+    // 等到状态不是 FIRING 时返回
+    int waitStable() const;
+
 private:
     bool m_recurring = false;
-    uint64_t m_ms = 0;
-    uint64_t m_next = 0;
+    // 周期与到期时刻, 微秒
+    std::atomic<uint64_t> m_us = {0};
+    std::atomic<uint64_t> m_next = {0};
+    // 允许晚于 m_next 触发的微秒数, 添加时确定; 时间轮据此把相近的到期时间并到同一时刻
+    std::atomic<uint64_t> m_slack = {0};
+    // 只在 IDLE 时由设置方写入, 所属线程在 ARMED->FIRING 之后读取
     Func m_cb = nullptr;
     TimerManager* m_manager = nullptr;
-
-private:
-    struct Comparator {
-        bool operator() (const Timer::Ptr& lhs, const Timer::Ptr& rhs) const;
-    };
+    std::atomic<int> m_state = {IDLE};
+    // 所在时间轮的分片, -1 表示不在任何时间轮中; 分片的所属线程挂入时以 CAS 认领
+    std::atomic<int> m_shard = {-1};
+
+    // 以下只由所在分片的所属线程访问
+    // 时间轮槽位中的侵入式双向链表, 插入、删除都不再分配内存
+    Timer* m_prev = nullptr;
+    Timer* m_succ = nullptr;
+    // 所在的层与槽, m_level 为-1表示不在时间轮中
+    int8_t m_level = -1;
+    uint8_t m_slot = 0;
+    // 在时间轮中时持有自身, 保证到期前不被释放; 其他线程取消后仍持有到原定的到期时刻
+    Ptr m_self;
 };
 
+/**
+ * @brief 定时器管理, 每个分片一个分层时间轮, 分片各归一个线程所有
+ * @details 精度 1us。第0层 256 个槽, 每槽 1us; 第1~6层各 64 个槽, 每槽跨度依次乘以 64,
+ *          共覆盖 2^44us(约203天), 更远的定时器先放在最高层, 降层时按实际到期时间重新放置。
+ *          分片只由其所属线程访问, 不加锁: 在所属线程上添加、取消、刷新直接改动时间轮;
+ *          其他线程经 postToTimerShard 把改动交给所属线程, 取消和推迟到期时间不投递:
+ *          已取消的定时器留在原来的槽中, 所属线程走到该槽时按定时器当前的状态与到期时间
+ *          摘下、重新放置或触发。
+ *          默认只有一个分片且调用线程即所属线程, 此时不能跨线程使用。
+ */
 class TimerManager {
 friend class Timer;
 public:
     using Ptr = std::shared_ptr<TimerManager>;
-    using Mutex = std::shared_mutex;
     using Func = std::function<void()>;
-    
-    TimerManager() = default;
-    
-    virtual ~TimerManager() = default;
-    
+
+    // 由 timer.slack_ms 决定松弛: 定时时长的 1/64, 不超过该配置值
+    static constexpr uint64_t DEFAULT_SLACK = ~0ull;
+
+    TimerManager();
+
+    virtual ~TimerManager();
+
     Timer::Ptr addTimer(uint64_t ms, Func cb, bool recurring = false);
-    
-    void addTimer(Timer::Ptr val, Mutex& lock);
+
+    /**
+     * @brief 以微秒为单位的 addTimer
+     * @param[in] slack_us 允许晚触发的微秒数, 到期时间相近的定时器在这个范围内合并为一次唤醒;
+     *            要求准时的定时器传0; 此时精度还受等待线程的内核定时器松弛限制,
+     *            EventPoller 创建的线程由 eventpoller.timer_slack_ns 设置
+     */
+    Timer::Ptr addTimerUs(uint64_t us, Func cb, bool recurring = false, uint64_t slack_us = DEFAULT_SLACK);
+
+    /**
+     * @brief 设置嵌入式的一次性定时器, 在所属线程上设置时不分配内存(cb 的捕获不超过两个指针大小时)
+     * @details timer 由调用方持有, 必须在触发或 cancel 之后才能再次设置; 其他线程 cancel 之后
+     *          它还留在分片中直到原定的到期时刻, 调用方须保证它活得比本管理器久。
+     *          在其他线程上再次设置且到期时间不早于上一次时不投递, 由原分片到期时重新放置
+     */
+    void addTimer(Timer& timer, uint64_t ms, Func cb);
 
     Timer::Ptr addConditionTimer(uint64_t ms, Func cb, std::weak_ptr<void> cond, bool recurring = false);
 
+    // 当前线程所属分片中最近的定时器还有多少毫秒到期(向上取整), 没有定时器或不是分片的所属线程时返回~0ull
     uint64_t getNextTimer();
 
+    // 同 getNextTimer, 单位为微秒
+    uint64_t getNextTimerUs();
+
+    // 取出当前线程所属分片中到期的回调
     void listExpiredCb(std::vector<std::function<void()> >& cbs);
 
     bool detectClockRollover(uint64_t now_ms);
 
+    // 是否还有未触发、未取消的定时器
     bool hasTimer();
+
 protected:
-    virtual void flushTimer() = 0;
+    // 重建为 n 个分片, 只能在添加定时器之前调用
+    void setTimerShards(size_t n);
+
+    // 当前线程所属的分片, 不是任何分片的所属线程时返回-1
+    virtual int currentTimerShard() { return 0; }
+
+    // 在分片 shard 的所属线程上执行 cb, 并在它睡眠时唤醒它
+    virtual void postToTimerShard(size_t shard, Func cb) { cb(); }
+
+private:
+    static constexpr int LEVELS = 7;
+    static constexpr int ROOT_BITS = 8;
+    static constexpr int LEVEL_BITS = 6;
+    static constexpr uint64_t ROOT_SIZE = 1ull << ROOT_BITS;
+    static constexpr uint64_t LEVEL_SIZE = 1ull << LEVEL_BITS;
+    static constexpr uint64_t MAX_SPAN = (1ull << (ROOT_BITS + LEVEL_BITS * (LEVELS - 1))) - 1;
+
+    // 一个分片的时间轮, 只由所属线程访问
+    struct Wheel {
+        Wheel();
+
+        // 按 m_next 放入对应的槽
+        void link(Timer* timer);
+
+        void unlink(Timer* timer);
+
+        Timer*& slotHead(int level, int slot);
+
+        // 把第 level 层的当前槽降到低层, 返回该层的下标是否回到0(需要继续降上一层)
+        bool cascade(int level);
+
+        // 第 level 层从当前位置起第一个非空槽的起始时间, 没有时返回~0ull
+        uint64_t firstSlotTime(int level) const;
+
+        // 最早可能到期的时刻, 不晚于其中任何定时器的实际到期时间
+        uint64_t nextExpire() const;
+
+        // 时间轮当前走到的时刻, 早于它的槽都已处理
+        uint64_t current = 0;
+        // 挂着的定时器数, 含其他线程取消后尚未摘下的
+        size_t count = 0;
+        // 以本分片的所属线程(非分片线程记在分片0)设置的定时器数减去取消、触发的数,
+        // 各分片之和是仍在等待的定时器数, 供 hasTimer 读取
+        std::atomic<int64_t> armed = {0};
+        Timer* root[ROOT_SIZE];
+        Timer* levels[LEVELS - 1][LEVEL_SIZE];
+        // 每层非空槽的位图
+        uint64_t rootBitmap[ROOT_SIZE / 64];
+        uint64_t levelBitmap[LEVELS - 1];
+    };
+
+    // 把已是 ARMED 的 timer 交给分片: 当前线程是可用分片的所属线程时直接挂入, 否则投递;
+    // later 为 true 表示它仍挂在的分片会在新的到期时间之前看到它, 不必投递
+    void arm(Timer* timer, bool later = false);
+
+    // 定时器的状态或到期时间变了; 在所属线程上立即调整, 其他线程上 notify 为 true 时投递给所属线程,
+    // 否则(已取消或只是推迟了到期时间)等它到期时再调整
+    void update(Timer* timer, bool notify);
+
+    // 在当前线程的分片上记下等待中的定时器数的变化
+    void countArmed(int64_t delta);
+
+    // 在所属线程上按 timer 当前的状态调整它在分片 shard 中的位置: ARMED 则(重新)挂入, 否则摘下
+    void reconcile(size_t shard, Timer* timer);
+
+    void post(size_t shard, Timer* timer);
+
+    // 时长 us 的定时器实际使用的松弛
+    uint64_t slackFor(uint64_t us, uint64_t slack_us) const;
+
+    // 从分片中摘下并解除认领, 返回时间轮持有的自引用, 由调用方在最后释放
+    Timer::Ptr drop(Wheel& wheel, Timer* timer);
+
+    // 摘下已取消的 timer 之后, 若它已被其他线程重新设置而那边认为它仍在本分片, 重新认领它;
+    // 返回 true 时由调用方挂入
+    bool reclaim(size_t shard, Timer* timer);
 
 private:
-    Mutex m_mtx;
-    bool m_tickled = false;
     uint64_t m_prevTime = 0;
-    std::set<Timer::Ptr, Timer::Comparator> m_timers;
+    // 默认松弛的上限, 微秒
+    uint64_t m_maxSlack = 0;
+    std::vector<std::unique_ptr<Wheel> > m_wheels;
+    // 跨线程添加时轮流选择分片
+    std::atomic<size_t> m_nextShard = {0};
 };
 
 } // namespace sylar
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,103 @@
+#ifndef _SYLAR_MPSC_QUEUE_H_
+#define _SYLAR_MPSC_QUEUE_H_
+
+#include <atomic>
+#include <memory>
+
+#include "util/util.h"
+
+namespace sylar {
+
+/**
+ * @brief 无锁多生产者单消费者队列(Vyukov 链表实现)
+ * @details push 可在任意线程调用, 只需一次原子交换;
+ *          pop 只能由唯一的消费者线程调用。
+ *          生产者交换完 head 但尚未链接 next 时, pop 会暂时返回 false, 消费者稍后重试即可。
+ */
+template<class ItemType>
+class MPSCQueue : public noncopyable {
+public:
+    using Ptr = std::shared_ptr<MPSCQueue>;
+
+    MPSCQueue() {
+        m_head.store(&m_stub, std::memory_order_relaxed);
+        m_tail = &m_stub;
+    }
+
+    ~MPSCQueue() {
+        ItemType tmp;
+        while(pop(tmp));
+    }
+
+    void push(ItemType item) {
+        Node* node = new Node;
+        node->value = std::move(item);
+        m_size.fetch_add(1, std::memory_order_relaxed);
+        pushNode(node);
+    }
+
+    bool pop(ItemType& item) {
+        Node* tail = m_tail;
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if(tail == &m_stub) {
+            if(!next) {
+                return false;
+            }
+            m_tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if(next) {
+            m_tail = next;
+            return take(tail, item);
+        }
+        if(tail != m_head.load(std::memory_order_acquire)) {
+            // 生产者正在链接
+            return false;
+        }
+        // 只剩最后一个节点, 放回 stub 后才能把它取出
+        m_stub.next.store(nullptr, std::memory_order_relaxed);
+        pushNode(&m_stub);
+        next = tail->next.load(std::memory_order_acquire);
+        if(next) {
+            m_tail = next;
+            return take(tail, item);
+        }
+        return false;
+    }
+
+    // 近似值, 任意线程可读
+    size_t size() const { return m_size.load(std::memory_order_acquire); }
+
+    bool empty() const { return size() == 0; }
+
+private:
+    struct Node {
+        std::atomic<Node*> next = {nullptr};
+        ItemType value;
+    };
+
+    void pushNode(Node* node) {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        Node* prev = m_head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    bool take(Node* node, ItemType& item) {
+        item = std::move(node->value);
+        delete node;
+        m_size.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    alignas(64) std::atomic<Node*> m_head;
+    alignas(64) Node* m_tail;
+    std::atomic<size_t> m_size = {0};
+    Node m_stub;
+};
+
+} // namespace sylar
+
+
+#endif //_SYLAR_MPSC_QUEUE_H_
@@ -0,0 +1,106 @@
+#ifndef _SYLAR_SEGMENTED_TABLE_H_
+#define _SYLAR_SEGMENTED_TABLE_H_
+
+#include <atomic>
+#include <memory>
+
+#include "util/util.h"
+
+namespace sylar {
+
+/**
+ * @brief 按下标索引的两级分段表, 用于以 fd 为下标的上下文
+ * @details 第一级是固定大小的段指针数组, 第二级每段 2^SEGMENT_BITS 个元素指针。
+ *          查找只有两次 acquire 读, 无锁且不等待; 段和元素都在第一次用到时才分配,
+ *          已有元素的地址在表的生命周期内不变。
+ *          同一下标被并发创建时只有一个胜出, 其余线程创建的对象被销毁。
+ *          元素只在析构时释放, 不支持删除。
+ */
+template<class ItemType, size_t SEGMENT_BITS = 10, size_t INDEX_BITS = 22>
+class SegmentedTable : public noncopyable {
+public:
+    static constexpr size_t SEGMENT_SIZE = (size_t)1 << SEGMENT_BITS;
+    static constexpr size_t SEGMENT_COUNT = (size_t)1 << (INDEX_BITS - SEGMENT_BITS);
+
+    SegmentedTable() {
+        for(auto& i : m_segments) {
+            i.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~SegmentedTable() {
+        for(auto& i : m_segments) {
+            Segment* seg = i.load(std::memory_order_relaxed);
+            if(!seg) {
+                continue;
+            }
+            for(auto& item : seg->items) {
+                delete item.load(std::memory_order_relaxed);
+            }
+            delete seg;
+        }
+    }
+
+    // 可容纳的下标上限(不含)
+    static constexpr size_t capacity() { return SEGMENT_SIZE * SEGMENT_COUNT; }
+
+    // 下标越界或尚未创建时返回nullptr
+    ItemType* get(size_t index) const {
+        if(index >= capacity()) {
+            return nullptr;
+        }
+        Segment* seg = m_segments[index >> SEGMENT_BITS].load(std::memory_order_acquire);
+        if(!seg) {
+            return nullptr;
+        }
+        return seg->items[index & (SEGMENT_SIZE - 1)].load(std::memory_order_acquire);
+    }
+
+    // 不存在时以 create(index) 创建, create 返回 new 出来的对象; 下标越界时返回nullptr
+    template<class F>
+    ItemType* getOrCreate(size_t index, F create) {
+        if(index >= capacity()) {
+            return nullptr;
+        }
+        std::atomic<Segment*>& slot = m_segments[index >> SEGMENT_BITS];
+        Segment* seg = slot.load(std::memory_order_acquire);
+        if(!seg) {
+            Segment* fresh = new Segment;
+            if(slot.compare_exchange_strong(seg, fresh, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                seg = fresh;
+            }
+            else {
+                delete fresh;
+            }
+        }
+
+        std::atomic<ItemType*>& item = seg->items[index & (SEGMENT_SIZE - 1)];
+        ItemType* ptr = item.load(std::memory_order_acquire);
+        if(ptr) {
+            return ptr;
+        }
+        ItemType* fresh = create(index);
+        if(item.compare_exchange_strong(ptr, fresh, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            return fresh;
+        }
+        delete fresh;
+        return ptr;
+    }
+
+private:
+    struct Segment {
+        Segment() {
+            for(auto& i : items) {
+                i.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+        std::atomic<ItemType*> items[SEGMENT_SIZE];
+    };
+
+    std::atomic<Segment*> m_segments[SEGMENT_COUNT];
+};
+
+} // namespace sylar
+
+
+#endif //_SYLAR_SEGMENTED_TABLE_H_
@@ -2,6 +2,7 @@
 #define _SYLAR_SINGLETON_H
 
 #include <mutex>
+#include <atomic>
 #include <memory>
 #include <iostream>
 
@@ -15,19 +16,26 @@ private:
     Singleton& operator=(const Singleton&) = delete;
 public:
     static T* getInstance() {
+        // 创建之后只有一次原子读, 每次 IO 都要取的 FdMgr 等不再加锁
+        T* instance = m_instance.load(std::memory_order_acquire);
+        if(instance) {
+            return instance;
+        }
         std::lock_guard<std::mutex> lock(m_mtx);
-        if(m_instance == nullptr) {
-            m_instance = new T();
+        instance = m_instance.load(std::memory_order_relaxed);
+        if(instance == nullptr) {
+            instance = new T();
+            m_instance.store(instance, std::memory_order_release);
         }
-        return m_instance;
+        return instance;
     }
 private:
-    static T* m_instance;
+    static std::atomic<T*> m_instance;
     static std::mutex m_mtx;
 };
 
 template<class T>
-T* Singleton<T>::m_instance = nullptr;
+std::atomic<T*> Singleton<T>::m_instance = {nullptr};
 
 template<class T>
 std::mutex Singleton<T>::m_mtx;
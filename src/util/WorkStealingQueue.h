@@ -0,0 +1,144 @@
+#ifndef _SYLAR_WORK_STEALING_QUEUE_H_
+#define _SYLAR_WORK_STEALING_QUEUE_H_
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+#include "util/util.h"
+
+namespace sylar {
+
+/**
+ * @brief Chase-Lev 工作窃取双端队列
+ * @details 只有拥有者线程可以调用 push/pop(在 bottom 端 LIFO 操作),
+ *          其他线程通过 steal 从 top 端 FIFO 窃取。
+ *          元素类型需为指针等可原子读写的平凡类型。
+ *          扩容时旧缓冲区不立即释放(窃取者可能仍在读),析构时统一回收。
+ */
+template<class ItemType>
+class WorkStealingQueue : public noncopyable {
+public:
+    using Ptr = std::shared_ptr<WorkStealingQueue>;
+
+    WorkStealingQueue(size_t capacity = 256) {
+        size_t cap = 1;
+        while(cap < capacity) {
+            cap <<= 1;
+        }
+        m_buffer.store(new Buffer(cap), std::memory_order_relaxed);
+    }
+
+    ~WorkStealingQueue() {
+        delete m_buffer.load(std::memory_order_relaxed);
+        for(auto i : m_retired) {
+            delete i;
+        }
+    }
+
+    // 仅拥有者线程调用
+    void push(ItemType item) {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_acquire);
+        Buffer* buf = m_buffer.load(std::memory_order_relaxed);
+        if(b - t > (int64_t)buf->capacity - 1) {
+            buf = grow(buf, b, t);
+        }
+        buf->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // 仅拥有者线程调用
+    bool pop(ItemType& item) {
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        Buffer* buf = m_buffer.load(std::memory_order_relaxed);
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        if(t > b) {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        item = buf->get(b);
+        if(t == b) {
+            // 只剩最后一个元素, 与窃取者竞争
+            bool won = m_top.compare_exchange_strong(t, t + 1,
+                            std::memory_order_seq_cst, std::memory_order_relaxed);
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // 任意线程调用
+    bool steal(ItemType& item) {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+        if(t >= b) {
+            return false;
+        }
+        Buffer* buf = m_buffer.load(std::memory_order_acquire);
+        item = buf->get(t);
+        return m_top.compare_exchange_strong(t, t + 1,
+                    std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    // 近似值, 仅用于统计/判空
+    size_t size() const {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        return b > t ? size_t(b - t) : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+private:
+    struct Buffer {
+        Buffer(size_t cap)
+            :capacity(cap)
+            ,mask(cap - 1)
+            ,items(new std::atomic<ItemType>[cap]) {
+        }
+
+        ~Buffer() {
+            delete[] items;
+        }
+
+        ItemType get(int64_t i) const {
+            return items[i & mask].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t i, ItemType item) {
+            items[i & mask].store(item, std::memory_order_relaxed);
+        }
+
+        size_t capacity;
+        size_t mask;
+        std::atomic<ItemType>* items;
+    };
+
+    Buffer* grow(Buffer* buf, int64_t b, int64_t t) {
+        Buffer* tmp = new Buffer(buf->capacity * 2);
+        for(int64_t i = t; i < b; ++i) {
+            tmp->put(i, buf->get(i));
+        }
+        m_retired.push_back(buf);
+        m_buffer.store(tmp, std::memory_order_release);
+        return tmp;
+    }
+
+private:
+    alignas(64) std::atomic<int64_t> m_top = {0};
+    alignas(64) std::atomic<int64_t> m_bottom = {0};
+    std::atomic<Buffer*> m_buffer = {nullptr};
+    // 只由拥有者线程访问
+    std::vector<Buffer*> m_retired;
+};
+
+} // namespace sylar
+
+
+#endif //_SYLAR_WORK_STEALING_QUEUE_H_
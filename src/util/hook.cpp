@@ -1,8 +1,11 @@
 #include "util/hook.h"
 
 #include <dlfcn.h>
+#include <string.h>
+#include <linux/io_uring.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 
 #include "socket/fdManager.h"
 #include "log/logger.h"
@@ -74,10 +77,6 @@ extern "C" {
     #undef XX
 }
 
-struct timer_info {
-    int cancelled = 0;
-};
-
 template<typename OriginFun, typename... Args>
 static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
         uint32_t event, int timeout_so, Args&&... args) {
@@ -86,7 +85,7 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    sylar::FdCtx::Ptr ctx = sylar::FdMgr::getInstance()->get(fd);
+    sylar::FdCtx* ctx = sylar::FdMgr::getInstance()->get(fd);
     if(!ctx) {
         return fun(fd, std::forward<Args>(args)...);
     }
@@ -101,45 +100,41 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
     }
 
     uint64_t to = ctx->getTimeout(timeout_so);
-    std::shared_ptr<timer_info> tinfo(new timer_info);
 
 retry:
     ssize_t n = fun(fd, std::forward<Args>(args)...);
     Log_Debug(g_logger) << "hook do io: " << hook_fun_name << ": " << n << " " << to;
-    while(n == -1 && errno == EINTR) {
+    // 重试时可能已经换了线程, errno 经 getErrno/setErrno 访问
+    while(n == -1 && sylar::getErrno() == EINTR) {
         n = fun(fd, std::forward<Args>(args)...);
     }
-    if(n == -1 && errno == EAGAIN) {
+    if(n == -1 && sylar::getErrno() == EAGAIN) {
         sylar::EventPoller* ep = sylar::EventPoller::getThis();
-        sylar::Timer::Ptr timer;
-        std::weak_ptr<timer_info> winfo(tinfo);
- 
-        if(to != (uint64_t)-1) {
-            timer = ep->addConditionTimer(to, [winfo, fd, ep, event]() {
-                auto t = winfo.lock();
-                if(!t || t->cancelled) {
-                    return;
-                }
-                t->cancelled = ETIMEDOUT;
-                ep->cancelEvent(fd, (sylar::EventPoller::Event)(event));
-            }, winfo);
+        sylar::EventPoller::Event ev = (sylar::EventPoller::Event)(event);
+        // 超时嵌在 fd 记录里, 设置、撤销都不分配内存
+        bool has_timeout = to != (uint64_t)-1;
+        if(has_timeout) {
+            ctx->armTimeout(ep, ev, to);
         }
 
-        int rt = ep->addEvent(fd, (sylar::EventPoller::Event)(event));
-        if(rt) {
+        int rt = ep->addEvent(fd, ev);
+        if(rt < 0) {
             Log_Error(g_logger) << hook_fun_name << " addEvent("
                 << fd << ", " << event << ")";
-            if(timer) {
-                timer->cancel();
+            if(has_timeout) {
+                ctx->disarmTimeout(ev);
             }
             return -1;
+        } else if(rt > 0) {
+            // 尝试 IO 之后已经到达了新的边沿, 不挂起直接重试
+            if(has_timeout) {
+                ctx->disarmTimeout(ev);
+            }
+            goto retry;
         } else {
             sylar::Fiber::yieldToHold();
-            if(timer) {
-                timer->cancel();
-            }
-            if(tinfo->cancelled) {
-                errno = tinfo->cancelled;
+            if(has_timeout && ctx->disarmTimeout(ev)) {
+                sylar::setErrno(ETIMEDOUT);
                 return -1;
             }
             goto retry;
@@ -149,6 +144,30 @@ retry:
     return n;
 }
 
+/**
+ * @brief io_uring 后端下由内核完成 IO, 不先尝试、不等就绪通知
+ * @return 不满足条件(未 hook、非 socket、用户设为非阻塞等)时返回false, 由 do_io 处理
+ */
+static bool do_async_io(int fd, int op, void* addr, uint32_t len, int flags,
+        int timeout_so, ssize_t& n) {
+    if(!sylar::is_hook_enable()) {
+        return false;
+    }
+    sylar::EventPoller* ep = sylar::EventPoller::getThis();
+    if(!ep || ep->getBackend() != sylar::EventPoller::IO_URING) {
+        return false;
+    }
+    sylar::FdCtx* ctx = sylar::FdMgr::getInstance()->get(fd);
+    if(!ctx || ctx->isClose() || !ctx->isSocket() || ctx->getUserNonblock()) {
+        return false;
+    }
+
+    do {
+        n = ep->asyncIo(op, fd, addr, len, flags, ctx->getTimeout(timeout_so));
+    } while(n == -1 && sylar::getErrno() == EINTR);
+    return n != -1 || sylar::getErrno() != ENOTSUP;
+}
+
 unsigned int sleep(unsigned int secs) {
     if(!sylar::t_hook_enable) {
         return sleep_f(secs);
@@ -168,9 +187,10 @@ int usleep(useconds_t usec) {
     }
     sylar::Fiber::Ptr fiber = sylar::Fiber::getThis();
     sylar::EventPoller* ep = sylar::EventPoller::getThis();
-    ep->addTimer(usec / 1000, [ep, fiber]() {
+    // 显式的睡眠多用于限速与重试, 要求准时, 不参与合并
+    ep->addTimerUs(usec, [ep, fiber]() {
         ep->schedule(fiber);
-    });
+    }, false, 0);
     sylar::Fiber::yieldToHold();
     return 0;
 }
@@ -179,12 +199,13 @@ int nanosleep(const struct timespec *req, struct timespec *rem) {
     if(!sylar::t_hook_enable) {
         return nanosleep_f(req, rem);
     }
-    int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
+    // 不足 1us 的部分向上取整, 不提前醒来
+    uint64_t timeout_us = req->tv_sec * 1000000ull + (req->tv_nsec + 999) / 1000;
     sylar::Fiber::Ptr fiber = sylar::Fiber::getThis();
     sylar::EventPoller* ep = sylar::EventPoller::getThis();
-    ep->addTimer(timeout_ms, [ep, fiber]() {
+    ep->addTimerUs(timeout_us, [ep, fiber]() {
         ep->schedule(fiber);
-    });
+    }, false, 0);
     sylar::Fiber::yieldToHold();
     return 0;
 }
@@ -202,6 +223,10 @@ int socket(int domain, int type, int protocol) {
 }
 
 ssize_t read(int fd, void *buf, size_t count) {
+    ssize_t n;
+    if(do_async_io(fd, IORING_OP_RECV, buf, count, 0, SO_RCVTIMEO, n)) {
+        return n;
+    }
     return do_io(fd, read_f, "read", sylar::EventPoller::READ, SO_RCVTIMEO, buf, count);
 }
 
@@ -210,6 +235,10 @@ ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
+    ssize_t n;
+    if(do_async_io(sockfd, IORING_OP_RECV, buf, len, flags, SO_RCVTIMEO, n)) {
+        return n;
+    }
     return do_io(sockfd, recv_f, "recv", sylar::EventPoller::READ, SO_RCVTIMEO, buf, len, flags);
 }
 
@@ -226,10 +255,23 @@ ssize_t write(int fd, const void *buf, size_t count) {
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+    // socket 上的 writev 等价于不带地址的 sendmsg
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (iovec*)iov;
+    msg.msg_iovlen = iovcnt;
+    ssize_t n;
+    if(do_async_io(fd, IORING_OP_SENDMSG, &msg, 1, 0, SO_SNDTIMEO, n)) {
+        return n;
+    }
     return do_io(fd, writev_f, "writev", sylar::EventPoller::WRITE, SO_SNDTIMEO, iov, iovcnt);
 }
 
 ssize_t send(int s, const void *msg, size_t len, int flags) {
+    ssize_t n;
+    if(do_async_io(s, IORING_OP_SEND, (void*)msg, len, flags, SO_SNDTIMEO, n)) {
+        return n;
+    }
     return do_io(s, send_f, "send", sylar::EventPoller::WRITE, SO_SNDTIMEO, msg, len, flags);
 }
 
@@ -245,7 +287,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     if(!sylar::t_hook_enable) {
         return connect_f(fd, addr, addrlen);
     }
-    sylar::FdCtx::Ptr ctx = sylar::FdMgr::getInstance()->get(fd);
+    sylar::FdCtx* ctx = sylar::FdMgr::getInstance()->get(fd);
     if(!ctx || ctx->isClose()) {
         errno = EBADF;
         return -1;
@@ -267,36 +309,25 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     }
 
     sylar::EventPoller* ep = sylar::EventPoller::getThis();
-    sylar::Timer::Ptr timer;
-    std::shared_ptr<timer_info> tinfo(new timer_info);
-    std::weak_ptr<timer_info> winfo(tinfo);
-
-    if(timeout_ms != (uint64_t)-1) {
-        timer = ep->addConditionTimer(timeout_ms, [winfo, fd, ep]() {
-                auto t = winfo.lock();
-                if(!t || t->cancelled) {
-                    return;
-                }
-                t->cancelled = ETIMEDOUT;
-                ep->cancelEvent(fd, sylar::EventPoller::WRITE);
-        }, winfo);
+    bool has_timeout = timeout_ms != (uint64_t)-1;
+    if(has_timeout) {
+        ctx->armTimeout(ep, sylar::EventPoller::WRITE, timeout_ms);
     }
 
     int rt = ep->addEvent(fd, sylar::EventPoller::WRITE);
     if(rt == 0) {
         sylar::Fiber::yieldToHold();
-        if(timer) {
-            timer->cancel();
-        }
-        if(tinfo->cancelled) {
-            errno = tinfo->cancelled;
+        if(has_timeout && ctx->disarmTimeout(sylar::EventPoller::WRITE)) {
+            sylar::setErrno(ETIMEDOUT);
             return -1;
         }
     } else {
-        if(timer) {
-            timer->cancel();
+        if(has_timeout) {
+            ctx->disarmTimeout(sylar::EventPoller::WRITE);
+        }
+        if(rt < 0) {
+            Log_Error(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
         }
-        Log_Error(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
     }
 
     int error = 0;
@@ -326,17 +357,17 @@ int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
 
 int close(int fd) {
     if(!sylar::t_hook_enable) {
+        // 不取消等待, 但内核会移除 epoll 注册, 同号 fd 复用时要重新注册
+        sylar::FdMgr::getInstance()->del(fd);
         return close_f(fd);
     }
 
-    sylar::FdCtx::Ptr ctx = sylar::FdMgr::getInstance()->get(fd);
-    if(ctx) {
-        auto iom = sylar::EventPoller::getThis();
-        if(iom) {
-            iom->cancelAll(fd);
-        }
-        sylar::FdMgr::getInstance()->del(fd);
+    // 记录不随 close 释放; 只经 addEvent 等待过、没有经钩子登记的 fd 也要清掉注册
+    auto iom = sylar::EventPoller::getThis();
+    if(iom) {
+        iom->cancelAll(fd);
     }
+    sylar::FdMgr::getInstance()->del(fd);
     return close_f(fd);
 }
 
@@ -348,7 +379,7 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
             {
                 int arg = va_arg(va, int);
                 va_end(va);
-                sylar::FdCtx::Ptr ctx = sylar::FdMgr::getInstance()->get(fd);
+                sylar::FdCtx* ctx = sylar::FdMgr::getInstance()->get(fd);
                 if(!ctx || ctx->isClose() || !ctx->isSocket()) {
                     return fcntl_f(fd, cmd, arg);
                 }
@@ -365,7 +396,7 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
             {
                 va_end(va);
                 int arg = fcntl_f(fd, cmd);
-                sylar::FdCtx::Ptr ctx = sylar::FdMgr::getInstance()->get(fd);
+                sylar::FdCtx* ctx = sylar::FdMgr::getInstance()->get(fd);
                 if(!ctx || ctx->isClose() || !ctx->isSocket()) {
                     return arg;
                 }
@@ -435,7 +466,7 @@ int ioctl(int d, unsigned long int request, ...) {
 
     if(FIONBIO == request) {
         bool user_nonblock = !!*(int*)arg;
-        sylar::FdCtx::Ptr ctx = sylar::FdMgr::getInstance()->get(d);
+        sylar::FdCtx* ctx = sylar::FdMgr::getInstance()->get(d);
         if(!ctx || ctx->isClose() || !ctx->isSocket()) {
             return ioctl_f(d, request, arg);
         }
@@ -454,7 +485,7 @@ int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t
     }
     if(level == SOL_SOCKET) {
         if(optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) {
-            sylar::FdCtx::Ptr ctx = sylar::FdMgr::getInstance()->get(sockfd);
+            sylar::FdCtx* ctx = sylar::FdMgr::getInstance()->get(sockfd);
             if(ctx) {
                 const timeval* v = (const timeval*)optval;
                 ctx->setTimeout(optname, v->tv_sec * 1000 + v->tv_usec / 1000);
@@ -1,6 +1,7 @@
 #include "util.h"
 #include <string.h>
 #include <string>
+#include <errno.h>
 #include <execinfo.h>
 #include <sys/time.h>
 #include <dirent.h>
@@ -31,6 +32,14 @@ uint64_t getCurrentMS() {
     return tv.tv_sec * 1000ul  + tv.tv_usec / 1000;
 }
 
+int getErrno() {
+    return errno;
+}
+
+void setErrno(int v) {
+    errno = v;
+}
+
 void Backtrace(std::vector<std::string>& bt, int size, int skip) {
     void** array = (void**)malloc((sizeof(void*) * size));
     size_t s = ::backtrace(array, size);
@@ -27,6 +27,15 @@ std::string BacktraceToString(int size = 64, int skip = 2, const std::string& pr
 
 uint64_t getCurrentMS();
 
+/**
+ * @brief 读写 errno
+ * @details 协程挂起后可能在另一个线程上恢复, 而编译器会把线程局部的 errno 地址缓存在挂起点两侧;
+ *          挂起之后访问 errno 要经过这两个不内联的函数
+ */
+int getErrno();
+
+void setErrno(int v);
+
 static uint64_t getTimeUsec() {
     auto now = std::chrono::high_resolution_clock::now();
     return std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
@@ -0,0 +1,101 @@
+#include "fiber/fiber.h"
+#include "fiber/context.h"
+#include "log/logger.h"
+
+#include <chrono>
+#include <iostream>
+#include <unistd.h>
+#include <ucontext.h>
+
+// 每种实现做 ROUNDS 次往返(每次往返两次切换), 输出每次切换的纳秒数
+
+static const uint64_t ROUNDS = 2000000;
+static const size_t STACK_SIZE = 64 * 1024;
+
+static double nsPerSwitch(std::chrono::steady_clock::time_point start) {
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / (ROUNDS * 2);
+}
+
+// ---------- ucontext ----------
+static ucontext_t s_uc_main;
+static ucontext_t s_uc_co;
+
+static void ucEntry() {
+    while(true) {
+        swapcontext(&s_uc_co, &s_uc_main);
+    }
+}
+
+static double benchUcontext() {
+    char* stack = new char[STACK_SIZE];
+    getcontext(&s_uc_co);
+    s_uc_co.uc_link = nullptr;
+    s_uc_co.uc_stack.ss_sp = stack;
+    s_uc_co.uc_stack.ss_size = STACK_SIZE;
+    makecontext(&s_uc_co, &ucEntry, 0);
+
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < ROUNDS; ++i) {
+        swapcontext(&s_uc_main, &s_uc_co);
+    }
+    double ns = nsPerSwitch(start);
+    delete[] stack;
+    return ns;
+}
+
+#ifdef SYLAR_HAVE_ASM_CONTEXT
+// ---------- asm ----------
+static void* s_asm_main = nullptr;
+static void* s_asm_co = nullptr;
+
+static void asmEntry() {
+    while(true) {
+        sylar_swap_context(&s_asm_co, s_asm_main);
+    }
+}
+
+static double benchAsm() {
+    char* stack = new char[STACK_SIZE];
+    s_asm_co = sylar_make_context(stack, STACK_SIZE, &asmEntry);
+
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < ROUNDS; ++i) {
+        sylar_swap_context(&s_asm_main, s_asm_co);
+    }
+    double ns = nsPerSwitch(start);
+    delete[] stack;
+    return ns;
+}
+#endif
+
+// ---------- Fiber(编译时选定的实现) ----------
+static double benchFiber() {
+    sylar::Fiber::getThis();
+    sylar::Fiber* raw = nullptr;
+    sylar::Fiber::Ptr fiber(new sylar::Fiber([&raw]() {
+        while(true) {
+            raw->back();
+        }
+    }, STACK_SIZE, true));
+    raw = fiber.get();
+
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < ROUNDS; ++i) {
+        fiber->call();
+    }
+    return nsPerSwitch(start);
+}
+
+int main(int argc, char** argv) {
+    Name_Logger("system")->setLevel(sylar::LogLevel::ERROR);
+
+    std::cout << "ucontext: " << benchUcontext() << " ns/switch\n";
+#ifdef SYLAR_HAVE_ASM_CONTEXT
+    std::cout << "asm:      " << benchAsm() << " ns/switch\n";
+#endif
+    std::cout << "Fiber(" << sylar::Context::Backend() << "): " << benchFiber() << " ns/switch\n";
+    // 协程体是死循环, 直接退出, 不析构仍在运行的协程
+    std::cout.flush();
+    _exit(0);
+}
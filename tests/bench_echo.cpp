@@ -0,0 +1,195 @@
+#include "eventpoller/eventpoller.h"
+#include "socket/socket.h"
+#include "socket/address.h"
+#include "log/logger.h"
+#include "config/config.h"
+
+#include <arpa/inet.h>
+#include <linux/perf_event.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// echo 服务在 epoll 与 io_uring 两种后端下, 每个请求/响应平均的系统调用次数
+// 客户端运行在 fork 出的子进程中, 只统计服务端进程
+// 计数使用 raw_syscalls:sys_enter 跟踪点, 需要挂载 tracefs(/sys/kernel/tracing)
+
+static const int CONNS = 8;
+static const int ROUNDS = 5000;
+static const size_t MSG_SIZE = 64;
+
+static int OpenSyscallCounter() {
+    const char* paths[] = {
+        "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+        "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+    };
+    long id = -1;
+    for(auto path : paths) {
+        FILE* fp = fopen(path, "r");
+        if(fp) {
+            if(fscanf(fp, "%ld", &id) != 1) {
+                id = -1;
+            }
+            fclose(fp);
+            break;
+        }
+    }
+    if(id < 0) {
+        return -1;
+    }
+
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_TRACEPOINT;
+    attr.config = id;
+    // 之后创建的线程(EventPoller 的工作线程)一并计入
+    attr.inherit = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t ReadCounter(int fd) {
+    uint64_t v = 0;
+    if(fd < 0 || read(fd, &v, sizeof(v)) != sizeof(v)) {
+        return 0;
+    }
+    return v;
+}
+
+static void RunClients(uint16_t port) {
+    std::vector<std::thread> threads;
+    for(int i = 0; i < CONNS; ++i) {
+        threads.emplace_back([port]() {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if(connect(fd, (sockaddr*)&addr, sizeof(addr))) {
+                perror("connect");
+                _exit(1);
+            }
+            char buf[MSG_SIZE];
+            memset(buf, 'x', sizeof(buf));
+            for(int r = 0; r < ROUNDS; ++r) {
+                if(send(fd, buf, sizeof(buf), 0) != (ssize_t)sizeof(buf)) {
+                    _exit(1);
+                }
+                size_t got = 0;
+                while(got < sizeof(buf)) {
+                    ssize_t n = recv(fd, buf + got, sizeof(buf) - got, 0);
+                    if(n <= 0) {
+                        _exit(1);
+                    }
+                    got += n;
+                }
+            }
+            close(fd);
+        });
+    }
+    for(auto& t : threads) {
+        t.join();
+    }
+}
+
+static void Bench(sylar::EventPoller::Backend backend, const char* name) {
+    // 先 fork 客户端再打开计数器, 计数只继承给之后创建的服务端线程
+    int go[2];
+    if(pipe(go)) {
+        return;
+    }
+    pid_t pid = fork();
+    if(pid == 0) {
+        uint16_t port;
+        close(go[1]);
+        if(read(go[0], &port, sizeof(port)) == sizeof(port)) {
+            RunClients(port);
+        }
+        _exit(0);
+    }
+    close(go[0]);
+
+    int counter = OpenSyscallCounter();
+    sylar::EventPoller ep(1, false, name, backend);
+    // 在调度线程里创建, 使监听 socket 经 hook 登记到 FdManager
+    sylar::Socket::Ptr listener = ep.scheduleWithResult([]() {
+        sylar::Socket::Ptr sock = sylar::Socket::CreateTCPSocket();
+        sock->bind(sylar::IPv4Address::Create("127.0.0.1", 0));
+        sock->listen();
+        return sock;
+    }).get();
+    uint16_t port = std::dynamic_pointer_cast<sylar::IPAddress>(listener->getLocalAddress())->getPort();
+
+    ep.schedule([listener, &ep]() {
+        while(true) {
+            sylar::Socket::Ptr client = listener->accept();
+            if(!client) {
+                break;
+            }
+            ep.schedule([client]() {
+                char buf[MSG_SIZE];
+                int n;
+                while((n = client->recv(buf, sizeof(buf))) > 0) {
+                    if(client->send(buf, n) != n) {
+                        break;
+                    }
+                }
+                client->close();
+            });
+        }
+    });
+
+    uint64_t before = ReadCounter(counter);
+    auto start = std::chrono::steady_clock::now();
+    if(write(go[1], &port, sizeof(port)) != sizeof(port)) {
+        return;
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    auto end = std::chrono::steady_clock::now();
+    uint64_t after = ReadCounter(counter);
+    close(go[1]);
+
+    uint64_t requests = (uint64_t)CONNS * ROUNDS;
+    double us = std::chrono::duration<double, std::micro>(end - start).count();
+    const char* actual = ep.getBackend() == sylar::EventPoller::IO_URING ? "io_uring" : "epoll";
+    if(counter >= 0) {
+        printf("%-10s (%s) %8.1f us/1k req, %5.2f syscalls/req", name, actual,
+               us * 1000 / requests, (double)(after - before) / requests);
+    } else {
+        printf("%-10s (%s) %8.1f us/1k req, syscall counter unavailable", name, actual,
+               us * 1000 / requests);
+    }
+    printf(", tickle issued %lu suppressed %lu", (unsigned long)ep.getTickleIssued(),
+           (unsigned long)ep.getTickleSuppressed());
+    if(ep.getSpinHit() || ep.getSpinMiss()) {
+        printf(", spin hit %lu miss %lu", (unsigned long)ep.getSpinHit(), (unsigned long)ep.getSpinMiss());
+    }
+    printf("\n");
+
+    ep.schedule([listener]() {
+        listener->close();
+    });
+    if(counter >= 0) {
+        close(counter);
+    }
+}
+
+int main() {
+    Name_Logger("system")->setLevel(sylar::LogLevel::ERROR);
+    Bench(sylar::EventPoller::EPOLL, "epoll");
+    Bench(sylar::EventPoller::IO_URING, "io_uring");
+    // 阻塞前最多忙等 50us; 服务端与客户端抢同一个 CPU 时忙等收益有限
+    sylar::Config::Lookup<uint32_t>("eventpoller.busy_poll_us")->setValue(50);
+    Bench(sylar::EventPoller::EPOLL, "epoll+spin");
+    return 0;
+}
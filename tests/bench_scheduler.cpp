@@ -0,0 +1,60 @@
+#include "eventpoller/eventpoller.h"
+#include "config/config.h"
+#include "log/logger.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <iostream>
+
+// 对比全局队列(scheduler.work_stealing=false)与本地队列+工作窃取的调度吞吐
+// 外部线程投递 SEEDS 个任务, 每个任务在工作线程内再派生 FANOUT 个子任务
+
+static const uint64_t SEEDS = 2000;
+static const uint64_t FANOUT = 100;
+
+static std::atomic<uint64_t> s_done {0};
+
+static void leaf() {
+    ++s_done;
+}
+
+static void seed() {
+    auto sc = sylar::Scheduler::getThis();
+    for(uint64_t i = 0; i < FANOUT; ++i) {
+        sc->schedule(&leaf);
+    }
+    ++s_done;
+}
+
+static double bench(size_t threads, bool stealing) {
+    sylar::Config::Lookup<bool>("scheduler.work_stealing")->setValue(stealing);
+    const uint64_t total = SEEDS * (FANOUT + 1);
+    s_done = 0;
+
+    sylar::EventPoller ep(threads, false, "bench");
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < SEEDS; ++i) {
+        ep.schedule(&seed);
+    }
+    while(s_done < total) {
+        std::this_thread::yield();
+    }
+    auto end = std::chrono::steady_clock::now();
+    double sec = std::chrono::duration<double>(end - start).count();
+    return total / sec;
+}
+
+int main(int argc, char** argv) {
+    Root_Logger()->setLevel(sylar::LogLevel::ERROR);
+    Name_Logger("system")->setLevel(sylar::LogLevel::ERROR);
+
+    size_t threads[] = {1, 4, 16, 64};
+    std::cout << "threads\tglobal(tasks/s)\tstealing(tasks/s)\n";
+    for(auto n : threads) {
+        double global = bench(n, false);
+        double stealing = bench(n, true);
+        std::cout << n << '\t' << uint64_t(global) << '\t' << uint64_t(stealing) << '\n';
+    }
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include "fiber/fiber.h"
+#include "fiber/context.h"
+#include "log/logger.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+#include <vector>
+
+// 挂起大量协程, 比较私有栈与共享栈模式下每个协程占用的常驻内存
+
+static size_t GetRss() {
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if(!fp) {
+        return 0;
+    }
+    size_t size = 0, resident = 0;
+    if(fscanf(fp, "%zu %zu", &size, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(fp);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+// 每个协程在栈上用掉约 2KB 后挂起
+static void Work() {
+    volatile char buf[2048];
+    memset((char*)buf, 1, sizeof(buf));
+    sylar::Fiber::getThis()->back();
+    buf[0] = buf[sizeof(buf) - 1];
+}
+
+static void Run(size_t n, bool shared) {
+    std::vector<sylar::Fiber::Ptr> fibers;
+    fibers.reserve(n);
+    size_t before = GetRss();
+    for(size_t i = 0; i < n; ++i) {
+        fibers.emplace_back(new sylar::Fiber(&Work, 0, true, shared));
+        fibers.back()->call();
+    }
+    size_t after = GetRss();
+
+    for(auto& i : fibers) {
+        i->call();
+    }
+    fibers.clear();
+
+    std::cout << (shared ? "shared " : "private") << "  fibers=" << n
+        << "  rss=" << (after - before) / 1024 << "KB"
+        << "  per_fiber=" << (after - before) / n << "B" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    Name_Logger("system")->setLevel(sylar::LogLevel::ERROR);
+    sylar::Fiber::getThis();
+    size_t n = argc > 1 ? atoi(argv[1]) : 10000;
+
+    std::cout << "backend: " << sylar::Context::Backend() << std::endl;
+    Run(n, false);
+    Run(n, true);
+    std::cout.flush();
+    _exit(0);
+}
@@ -0,0 +1,124 @@
+#include "fiber/task.h"
+#include "fiber/fiber.h"
+#include "log/logger.h"
+
+#include <chrono>
+#include <iostream>
+
+#ifdef SYLAR_HAVE_TASK
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+// 无栈协程与 Fiber 对比: 挂起状态下每个的常驻内存, 以及一次挂起/恢复往返的耗时
+
+static const uint64_t ROUNDS = 2000000;
+
+static size_t GetRss() {
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if(!fp) {
+        return 0;
+    }
+    size_t size = 0, resident = 0;
+    if(fscanf(fp, "%zu %zu", &size, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(fp);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static double nsPerRound(std::chrono::steady_clock::time_point start) {
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / ROUNDS;
+}
+
+static sylar::CoTask<void> Loop() {
+    while(true) {
+        co_await std::suspend_always{};
+    }
+}
+
+static double benchTaskSwitch() {
+    auto task = Loop();
+    auto h = task.handle();
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < ROUNDS; ++i) {
+        h.resume();
+    }
+    return nsPerRound(start);
+}
+
+static double benchFiberSwitch() {
+    sylar::Fiber::Ptr fiber(new sylar::Fiber([]() {
+        while(true) {
+            sylar::Fiber::getThis()->back();
+        }
+    }));
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < ROUNDS; ++i) {
+        fiber->call();
+    }
+    return nsPerRound(start);
+}
+
+// 挂起前后都用到一个小缓冲区, 使其必须跨挂起点存活
+static sylar::CoTask<void> Parked() {
+    char buf[256];
+    memset(buf, 1, sizeof(buf));
+    co_await std::suspend_always{};
+    buf[0] = buf[sizeof(buf) - 1];
+}
+
+static void benchMemory(size_t n) {
+    size_t before = GetRss();
+    std::vector<sylar::CoTask<void> > tasks;
+    tasks.reserve(n);
+    for(size_t i = 0; i < n; ++i) {
+        tasks.push_back(Parked());
+        tasks.back().handle().resume();
+    }
+    size_t after = GetRss();
+    std::cout << "task   parked=" << n << "  per_item=" << (after - before) / n << "B" << std::endl;
+    tasks.clear();
+
+    before = GetRss();
+    std::vector<sylar::Fiber::Ptr> fibers;
+    fibers.reserve(n);
+    for(size_t i = 0; i < n; ++i) {
+        fibers.emplace_back(new sylar::Fiber([]() {
+            char buf[256];
+            memset(buf, 1, sizeof(buf));
+            sylar::Fiber::getThis()->back();
+            buf[0] = buf[sizeof(buf) - 1];
+        }));
+        fibers.back()->call();
+    }
+    after = GetRss();
+    std::cout << "fiber  parked=" << n << "  per_item=" << (after - before) / n << "B" << std::endl;
+    for(auto& i : fibers) {
+        i->call();
+    }
+}
+
+int main(int argc, char** argv) {
+    Name_Logger("system")->setLevel(sylar::LogLevel::ERROR);
+    sylar::Fiber::getThis();
+    size_t n = argc > 1 ? atoi(argv[1]) : 10000;
+
+    std::cout << "task  ns/round-trip: " << benchTaskSwitch() << std::endl;
+    std::cout << "fiber ns/round-trip: " << benchFiberSwitch() << " (" << sylar::Context::Backend() << ")" << std::endl;
+    benchMemory(n);
+    std::cout.flush();
+    _exit(0);
+}
+
+#else
+
+int main() {
+    std::cout << "coroutine CoTask needs C++20 (SYLAR_COROUTINE), skipped" << std::endl;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,110 @@
+#include "timer/timer.h"
+#include "util/util.h"
+
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <unistd.h>
+#include <vector>
+
+// TimerManager 在 1万/10万/100万个存活定时器下的添加、刷新、取消以及到期收集的耗时
+
+static double nsPerOp(std::chrono::steady_clock::time_point start, size_t ops) {
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / ops;
+}
+
+static void benchLive(size_t count) {
+    sylar::TimerManager mgr;
+    std::mt19937 rng(count);
+    std::uniform_int_distribution<uint64_t> timeout(1000, 60000);
+    std::vector<sylar::Timer::Ptr> timers;
+    timers.reserve(count);
+
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < count; ++i) {
+        timers.push_back(mgr.addTimer(timeout(rng), []() {}));
+    }
+    double add = nsPerOp(start, count);
+
+    start = std::chrono::steady_clock::now();
+    for(auto& i : timers) {
+        i->refresh();
+    }
+    double refresh = nsPerOp(start, count);
+
+    start = std::chrono::steady_clock::now();
+    for(auto& i : timers) {
+        i->reset(timeout(rng), true);
+    }
+    double reset = nsPerOp(start, count);
+
+    start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < 100000; ++i) {
+        mgr.getNextTimer();
+    }
+    double next = nsPerOp(start, 100000);
+
+    start = std::chrono::steady_clock::now();
+    for(auto& i : timers) {
+        i->cancel();
+    }
+    double cancel = nsPerOp(start, count);
+
+    printf("%8zu live: add %6.1f  refresh %6.1f  reset %6.1f  cancel %6.1f  getNextTimer %6.1f ns/op\n",
+            count, add, refresh, reset, cancel, next);
+}
+
+// count 个定时器在 0~span ms 内陆续到期, 每个都应触发且不早于其到期时间;
+// coalesce 为 false 时不留松弛, 对比合并前后的唤醒轮数
+static bool benchExpire(size_t count, uint64_t span, bool coalesce = true) {
+    sylar::TimerManager mgr;
+    std::mt19937 rng(count);
+    std::uniform_int_distribution<uint64_t> timeout(0, span);
+    size_t early = 0, fired = 0;
+    uint64_t begin = sylar::getTimeUsec();
+    for(size_t i = 0; i < count; ++i) {
+        uint64_t ms = timeout(rng);
+        uint64_t due = begin + ms * 1000;
+        mgr.addTimerUs(ms * 1000, [due, &early, &fired]() {
+            if(sylar::getTimeUsec() < due) {
+                ++early;
+            }
+            ++fired;
+        }, false, coalesce ? sylar::TimerManager::DEFAULT_SLACK : 0);
+    }
+
+    double collect = 0;
+    size_t rounds = 0;
+    std::vector<std::function<void()> > cbs;
+    while(mgr.hasTimer()) {
+        uint64_t wait = mgr.getNextTimerUs();
+        if(wait) {
+            usleep(wait);
+        }
+        auto start = std::chrono::steady_clock::now();
+        mgr.listExpiredCb(cbs);
+        collect += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        ++rounds;
+        for(auto& cb : cbs) {
+            cb();
+        }
+        cbs.clear();
+    }
+    bool ok = fired == count && early == 0;
+    printf("%8zu expire over %llums%s: %zu rounds, listExpiredCb %.1f ns/timer, %s\n",
+            count, (unsigned long long)span, coalesce ? "" : " (no slack)",
+            rounds, collect / count, ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+int main() {
+    for(size_t count : {10000, 100000, 1000000}) {
+        benchLive(count);
+    }
+    bool ok = benchExpire(100000, 2000);
+    ok = benchExpire(20000, 300) && ok;
+    ok = benchExpire(1000, 20000) && ok;
+    ok = benchExpire(1000, 20000, false) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,131 @@
+#include "eventpoller/eventpoller.h"
+#include "fiber/channel.h"
+#include "log/logger.h"
+
+#include <atomic>
+#include <string>
+#include <unistd.h>
+
+// 通道在多线程多协程下的收发、关闭与 select
+
+static const int PRODUCERS = 8;
+static const int ITEMS = 2000;
+
+static void WaitDone(std::atomic<int>& done, int n) {
+    while(done != n) {
+        usleep(1000);
+    }
+}
+
+// 多个生产者向一个通道发送, 多个消费者接收, 关闭后消费者退出
+static bool TestPipeline(sylar::EventPoller::Ptr ep, size_t capacity) {
+    sylar::Channel<int> ch(capacity);
+    std::atomic<int64_t> sum = {0};
+    std::atomic<int> producers = {0};
+    std::atomic<int> consumers = {0};
+    for(int i = 0; i < PRODUCERS; ++i) {
+        ep->schedule([&]() {
+            for(int j = 0; j < ITEMS; ++j) {
+                ch.send(j);
+            }
+            if(++producers == PRODUCERS) {
+                ch.close();
+            }
+        });
+    }
+    for(int i = 0; i < 4; ++i) {
+        ep->schedule([&]() {
+            int v;
+            while(ch.recv(v)) {
+                sum += v;
+            }
+            ++consumers;
+        });
+    }
+    WaitDone(consumers, 4);
+    int64_t expect = (int64_t)PRODUCERS * ITEMS * (ITEMS - 1) / 2;
+    Log_Info(Root_Logger()) << "pipeline capacity=" << capacity << " sum=" << sum << " expect=" << expect;
+    return sum == expect && !ch.send(0);
+}
+
+static bool TestTry() {
+    sylar::Channel<std::string> ch(1);
+    std::string s = "a";
+    bool ok = ch.trySend(s);
+    s = "b";
+    ok = ok && !ch.trySend(s) && s == "b";
+    std::string out;
+    ok = ok && ch.tryRecv(out) && out == "a";
+    ok = ok && !ch.tryRecv(out);
+    ch.close();
+    ok = ok && !ch.trySend(std::string("c"));
+    Log_Info(Root_Logger()) << "try ok=" << ok;
+    return ok;
+}
+
+// 从两个通道 select 接收, 另有一个退出通道
+static bool TestSelect(sylar::EventPoller::Ptr ep) {
+    sylar::Channel<int> a(0), b(4);
+    sylar::Channel<bool> quit(0);
+    std::atomic<int> done = {0};
+    int64_t got_a = 0, got_b = 0;
+    ep->schedule([&]() {
+        for(int i = 0; i < ITEMS; ++i) {
+            a.send(1);
+        }
+        ++done;
+    });
+    ep->schedule([&]() {
+        for(int i = 0; i < ITEMS; ++i) {
+            b.send(2);
+        }
+        ++done;
+    });
+    ep->schedule([&]() {
+        int va = 0, vb = 0;
+        bool q = false, ok = false;
+        while(true) {
+            int idx = sylar::Select({a.recvCase(va), b.recvCase(vb), quit.recvCase(q, &ok)});
+            if(idx == 0) {
+                got_a += va;
+            }
+            else if(idx == 1) {
+                got_b += vb;
+            }
+            else {
+                break;
+            }
+        }
+        ++done;
+    });
+    WaitDone(done, 2);
+    // 生产者都已完成, 等缓冲区清空后通知退出
+    while(b.size()) {
+        usleep(1000);
+    }
+    quit.send(true);
+    WaitDone(done, 3);
+    Log_Info(Root_Logger()) << "select a=" << got_a << " b=" << got_b;
+    bool ok = got_a == ITEMS && got_b == 2 * ITEMS;
+
+    // 非阻塞 select
+    int v;
+    ok = ok && sylar::Select({a.recvCase(v), b.recvCase(v)}, false) == -1;
+    return ok;
+}
+
+int main() {
+    Name_Logger("system")->setLevel(sylar::LogLevel::ERROR);
+    sylar::EventPoller::Ptr ep(new sylar::EventPoller(4, false));
+    ep->start();
+
+    bool ok = TestPipeline(ep, sylar::Channel<int>::UNBOUNDED);
+    ok = TestPipeline(ep, 16) && ok;
+    ok = TestPipeline(ep, 0) && ok;
+    ok = TestTry() && ok;
+    ok = TestSelect(ep) && ok;
+
+    ep->stop();
+    Log_Info(Root_Logger()) << (ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,155 @@
+#include "eventpoller/eventpoller.h"
+#include "socket/fdManager.h"
+#include "config/config.h"
+#include "log/logger.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+
+// epoll(共享/每线程 Loop)与 io_uring 后端行为一致: 收发、接收超时、等待中被 close、addEvent 回调、
+// 钩子之外关闭后同号 fd 的复用
+// 开启 io_affinity 时就绪的协程回到原线程
+
+static bool RunChecks(sylar::EventPoller::Backend backend) {
+    sylar::EventPoller::Ptr ep(new sylar::EventPoller(2, false, "backend", backend));
+    std::string name = ep->getBackend() == sylar::EventPoller::IO_URING ? "io_uring"
+        : ep->isPerThreadLoop() ? "epoll per-thread" : "epoll";
+    if(ep->isIoAffinity()) {
+        name += " affinity";
+    }
+
+    auto result = ep->scheduleWithResult([ep]() {
+        bool ok = true;
+        int sv[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+        sylar::FdMgr::getInstance()->get(sv[0], true);
+        sylar::FdMgr::getInstance()->get(sv[1], true);
+
+        // 1. 先挂起等待, 对端稍后写入
+        int peer = sv[1];
+        ep->schedule([peer]() {
+            usleep(10 * 1000);
+            send(peer, "hello", 5, 0);
+        });
+        char buf[16] = {0};
+        int thread = sylar::getThreadId();
+        ssize_t n = recv(sv[0], buf, sizeof(buf), 0);
+        ok = ok && n == 5 && memcmp(buf, "hello", 5) == 0;
+        // 每线程 Loop: 连接注册在当前线程的 Loop 上, 就绪后回到同一线程; io_affinity 同理
+        if(ep->isPerThreadLoop() || ep->isIoAffinity()) {
+            ok = ok && thread == sylar::getThreadId();
+        }
+
+        iovec iov[2] = {{(void*)"wor", 3}, {(void*)"ld", 2}};
+        n = writev(sv[1], iov, 2);
+        ok = ok && n == 5;
+        n = read(sv[0], buf, sizeof(buf));
+        ok = ok && n == 5 && memcmp(buf, "world", 5) == 0;
+
+        // 2. 接收超时
+        timeval tv = {0, 50 * 1000};
+        setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        uint64_t start = sylar::getCurrentMS();
+        n = recv(sv[0], buf, sizeof(buf), 0);
+        int err = sylar::getErrno();
+        uint64_t used = sylar::getCurrentMS() - start;
+        ok = ok && n == -1 && err == ETIMEDOUT && used >= 40;
+        Log_Info(Root_Logger()) << "timeout n=" << n << " errno=" << err << " used=" << used << "ms";
+
+        // 3. 等待中被关闭
+        tv.tv_sec = 10;
+        setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        int fd = sv[0];
+        ep->schedule([fd]() {
+            usleep(10 * 1000);
+            close(fd);
+        });
+        start = sylar::getCurrentMS();
+        n = recv(fd, buf, sizeof(buf), 0);
+        err = sylar::getErrno();
+        used = sylar::getCurrentMS() - start;
+        ok = ok && n == -1 && used < 1000;
+        Log_Info(Root_Logger()) << "closed n=" << n << " errno=" << err << " used=" << used << "ms";
+
+        // 4. 回调方式的 addEvent
+        int pv[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, pv);
+        sylar::FdMgr::getInstance()->get(pv[0], true);
+        sylar::Promise<void> fired;
+        sylar::Future<void> done = fired.getFuture();
+        auto p = std::make_shared<sylar::Promise<void> >(std::move(fired));
+        ep->addEvent(pv[0], sylar::EventPoller::READ, [p]() { p->setValue(); });
+        send(pv[1], "x", 1, 0);
+        done.wait();
+        // 已注册的 fd 上缓存的可写边沿: 回调立即调度而不是被丢弃
+        sylar::Promise<void> writable;
+        sylar::Future<void> wdone = writable.getFuture();
+        auto w = std::make_shared<sylar::Promise<void> >(std::move(writable));
+        int rt = ep->addEvent(pv[0], sylar::EventPoller::WRITE, [w]() { w->setValue(); });
+        wdone.wait();
+        ok = ok && rt == 0;
+
+        close(sv[1]);
+        close(pv[0]);
+        close(pv[1]);
+        return ok;
+    });
+
+    bool ok = result.get();
+
+    // 5. 工作线程中等待过的 fd 在调度器之外的线程关闭(不经钩子), 同号 fd 复用后仍能等到事件
+    int sv[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    auto waited = ep->scheduleWithResult([ep, sv]() {
+        sylar::FdMgr::getInstance()->get(sv[0], true);
+        char c;
+        return recv(sv[0], &c, 1, 0);
+    });
+    usleep(20 * 1000);
+    send(sv[1], "x", 1, 0);
+    ok = waited.get() == 1 && ok;
+    int reused = sv[0];
+    close(sv[0]);
+    close(sv[1]);
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    if(sv[0] == reused) {
+        std::atomic<bool> fired = {false};
+        int rt = ep->addEvent(sv[0], sylar::EventPoller::READ, [&fired]() { fired = true; });
+        send(sv[1], "y", 1, 0);
+        uint64_t start = sylar::getCurrentMS();
+        while(!fired && sylar::getCurrentMS() - start < 1000) {
+            usleep(1000);
+        }
+        Log_Info(Root_Logger()) << "reused fd rt=" << rt << " fired=" << fired;
+        ok = ok && rt == 0 && fired;
+    }
+    close(sv[0]);
+    close(sv[1]);
+
+    ep->stop();
+    if(ep->isIoAffinity()) {
+        Log_Info(Root_Logger()) << name << " pinned=" << ep->getIoPinned()
+            << " migrated=" << ep->getIoMigrated();
+    }
+    Log_Info(Root_Logger()) << name << (ok ? " PASS" : " FAIL");
+    return ok;
+}
+
+int main() {
+    Name_Logger("system")->setLevel(sylar::LogLevel::ERROR);
+    bool ok = RunChecks(sylar::EventPoller::EPOLL);
+    ok = RunChecks(sylar::EventPoller::IO_URING) && ok;
+    sylar::Config::Lookup<bool>("eventpoller.per_thread_loop")->setValue(true);
+    ok = RunChecks(sylar::EventPoller::EPOLL) && ok;
+    sylar::Config::Lookup<bool>("eventpoller.per_thread_loop")->setValue(false);
+    sylar::Config::Lookup<bool>("eventpoller.io_affinity")->setValue(true);
+    ok = RunChecks(sylar::EventPoller::EPOLL) && ok;
+    ok = RunChecks(sylar::EventPoller::IO_URING) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,38 @@
+#include "eventpoller/eventpoller.h"
+#include "config/config.h"
+#include "log/logger.h"
+
+#include <atomic>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// 每线程 Loop 模式下, 根线程在 run 之外登记的回调不能落在只在 stop 时才轮询的根线程 Loop 上
+
+int main() {
+    Name_Logger("system")->setLevel(sylar::LogLevel::ERROR);
+    sylar::Config::Lookup<bool>("eventpoller.per_thread_loop")->setValue(true);
+    sylar::EventPoller ep(3, true);
+    const int N = 6;
+    int sv[N][2];
+    std::atomic<int> fired = {0};
+    for(int i = 0; i < N; ++i) {
+        socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]);
+        ep.addEvent(sv[i][0], sylar::EventPoller::READ, [&fired]() { ++fired; });
+    }
+    for(int i = 0; i < N; ++i) {
+        write(sv[i][1], "x", 1);
+    }
+    uint64_t start = sylar::getCurrentMS();
+    while(fired != N && sylar::getCurrentMS() - start < 2000) {
+        usleep(1000);
+    }
+    int n = fired;
+    ep.stop();
+    for(int i = 0; i < N; ++i) {
+        close(sv[i][0]);
+        close(sv[i][1]);
+    }
+    bool ok = n == N;
+    Log_Info(Root_Logger()) << "caller register fired " << n << "/" << N << (ok ? " PASS" : " FAIL");
+    return ok ? 0 : 1;
+}
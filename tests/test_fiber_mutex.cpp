@@ -0,0 +1,189 @@
+#include "eventpoller/eventpoller.h"
+#include "fiber/fiber_mutex.h"
+#include "log/logger.h"
+
+#include <atomic>
+#include <shared_mutex>
+#include <unistd.h>
+
+// 多线程多协程下检查互斥锁/条件变量/信号量/读写锁的正确性, 等待期间线程可继续运行其他协程
+
+static const int FIBERS = 200;
+static const int LOOPS = 200;
+
+static bool TestMutex(sylar::EventPoller::Ptr ep) {
+    sylar::FiberMutex mtx;
+    int64_t value = 0;
+    std::atomic<int> done = {0};
+    for(int i = 0; i < FIBERS; ++i) {
+        ep->schedule([&]() {
+            for(int j = 0; j < LOOPS; ++j) {
+                std::lock_guard<sylar::FiberMutex> lock(mtx);
+                int64_t v = value;
+                if(j % 16 == 0) {
+                    // 持锁挂起, 让其他协程撞上锁
+                    usleep(10);
+                }
+                value = v + 1;
+            }
+            ++done;
+        });
+    }
+    while(done != FIBERS) {
+        usleep(1000);
+    }
+    Log_Info(Root_Logger()) << "mutex value=" << value;
+    return value == FIBERS * LOOPS;
+}
+
+static bool TestCondition(sylar::EventPoller::Ptr ep) {
+    sylar::FiberMutex mtx;
+    sylar::FiberCondition cond;
+    std::deque<int> items;
+    int64_t sum = 0;
+    std::atomic<int> done = {0};
+    for(int i = 0; i < FIBERS; ++i) {
+        ep->schedule([&, i]() {
+            sylar::FiberMutex::Lock lock(mtx);
+            items.push_back(i);
+            cond.notify_one();
+        });
+    }
+    for(int i = 0; i < 4; ++i) {
+        ep->schedule([&]() {
+            while(true) {
+                sylar::FiberMutex::Lock lock(mtx);
+                cond.wait(lock, [&]() { return !items.empty(); });
+                int v = items.front();
+                items.pop_front();
+                if(v < 0) {
+                    break;
+                }
+                sum += v;
+                if(++done == FIBERS) {
+                    for(int k = 0; k < 4; ++k) {
+                        items.push_back(-1);
+                    }
+                    cond.notify_all();
+                }
+            }
+        });
+    }
+    while(true) {
+        {
+            sylar::FiberMutex::Lock lock(mtx);
+            if(done == FIBERS && items.empty()) {
+                break;
+            }
+        }
+        usleep(1000);
+    }
+    Log_Info(Root_Logger()) << "condition sum=" << sum;
+    return sum == FIBERS * (FIBERS - 1) / 2;
+}
+
+static bool TestSemaphore(sylar::EventPoller::Ptr ep) {
+    sylar::FiberSemaphore sem(3);
+    std::atomic<int> inside = {0};
+    std::atomic<int> max_inside = {0};
+    std::atomic<int> done = {0};
+    for(int i = 0; i < FIBERS; ++i) {
+        ep->schedule([&]() {
+            sem.wait();
+            int n = ++inside;
+            int m = max_inside;
+            while(n > m && !max_inside.compare_exchange_weak(m, n));
+            usleep(10);
+            --inside;
+            sem.notify();
+            ++done;
+        });
+    }
+    while(done != FIBERS) {
+        usleep(1000);
+    }
+    Log_Info(Root_Logger()) << "semaphore max inside=" << max_inside;
+    return max_inside <= 3;
+}
+
+static bool TestRWMutex(sylar::EventPoller::Ptr ep) {
+    sylar::FiberRWMutex mtx;
+    std::atomic<int> readers = {0};
+    std::atomic<int> writers = {0};
+    std::atomic<bool> bad = {false};
+    std::atomic<int> done = {0};
+    for(int i = 0; i < FIBERS; ++i) {
+        ep->schedule([&, i]() {
+            for(int j = 0; j < LOOPS / 10; ++j) {
+                if((i + j) % 8 == 0) {
+                    std::unique_lock<sylar::FiberRWMutex> lock(mtx);
+                    if(++writers != 1 || readers != 0) {
+                        bad = true;
+                    }
+                    usleep(10);
+                    --writers;
+                }
+                else {
+                    std::shared_lock<sylar::FiberRWMutex> lock(mtx);
+                    ++readers;
+                    if(writers != 0) {
+                        bad = true;
+                    }
+                    usleep(10);
+                    --readers;
+                }
+            }
+            ++done;
+        });
+    }
+    while(done != FIBERS) {
+        usleep(1000);
+    }
+    Log_Info(Root_Logger()) << "rwmutex bad=" << bad;
+    return !bad;
+}
+
+// use_caller 的根线程在 run 之外等待: 只能阻塞线程, 不能 yield 根协程
+static bool TestCallerThread() {
+    sylar::EventPoller::Ptr ep(new sylar::EventPoller(3, true));
+    ep->start();
+
+    sylar::FiberMutex mtx;
+    sylar::FiberSemaphore sem(0);
+    int64_t value = 0;
+    for(int i = 0; i < FIBERS; ++i) {
+        ep->schedule([&]() {
+            for(int j = 0; j < LOOPS; ++j) {
+                std::lock_guard<sylar::FiberMutex> lock(mtx);
+                ++value;
+            }
+            sem.notify();
+        });
+    }
+    for(int j = 0; j < LOOPS; ++j) {
+        std::lock_guard<sylar::FiberMutex> lock(mtx);
+        ++value;
+    }
+    for(int i = 0; i < FIBERS; ++i) {
+        sem.wait();
+    }
+    ep->stop();
+    Log_Info(Root_Logger()) << "caller thread value=" << value;
+    return value == (FIBERS + 1) * LOOPS;
+}
+
+int main() {
+    Name_Logger("system")->setLevel(sylar::LogLevel::ERROR);
+    sylar::EventPoller::Ptr ep(new sylar::EventPoller(4, false));
+    ep->start();
+
+    bool ok = TestMutex(ep);
+    ok = TestCondition(ep) && ok;
+    ok = TestSemaphore(ep) && ok;
+    ok = TestRWMutex(ep) && ok;
+
+    ep->stop();
+    ok = TestCallerThread() && ok;
+    Log_Info(Root_Logger()) << (ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
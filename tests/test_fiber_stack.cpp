@@ -0,0 +1,24 @@
+#include "fiber/fiber.h"
+#include "log/logger.h"
+
+// 反复创建销毁协程, 稳态下栈应全部来自缓存池
+int main() {
+    Name_Logger("system")->setLevel(sylar::LogLevel::ERROR);
+    sylar::Fiber::getThis();
+
+    int cnt = 0;
+    for(int i = 0; i < 10000; ++i) {
+        sylar::Fiber::Ptr fiber(new sylar::Fiber([&cnt]() {
+            ++cnt;
+        }));
+        fiber->call();
+    }
+
+    auto stats = sylar::Fiber::GetStackStats();
+    Log_Info(Root_Logger()) << "fibers run: " << cnt
+        << " mapped: " << stats.mapped
+        << " cached: " << stats.cached
+        << " hits: " << stats.hits
+        << " misses: " << stats.misses;
+    return stats.misses == 1 ? 0 : 1;
+}
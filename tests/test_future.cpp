@@ -0,0 +1,92 @@
+#include "eventpoller/eventpoller.h"
+#include "log/logger.h"
+
+#include <stdexcept>
+#include <unistd.h>
+
+// scheduleWithResult 的扇出/扇入, 异常传递, 以及等待只挂起协程
+
+int main() {
+    Name_Logger("system")->setLevel(sylar::LogLevel::ERROR);
+    bool ok = true;
+
+    {
+        sylar::EventPoller::Ptr ep(new sylar::EventPoller(4, false));
+        ep->start();
+
+        std::vector<sylar::Future<int64_t> > futures;
+        for(int64_t i = 0; i < 1000; ++i) {
+            futures.push_back(ep->scheduleWithResult([i]() { return i * i; }));
+        }
+        sylar::whenAll(futures).wait();
+        int64_t sum = 0;
+        for(auto& i : futures) {
+            sum += i.get();
+        }
+        Log_Info(Root_Logger()) << "whenAll sum=" << sum;
+        ok = ok && sum == 332833500;
+
+        std::vector<sylar::Future<void> > any;
+        any.push_back(ep->scheduleWithResult([]() { usleep(200 * 1000); }));
+        any.push_back(ep->scheduleWithResult([]() { usleep(10 * 1000); }));
+        size_t idx = sylar::whenAny(any).get();
+        Log_Info(Root_Logger()) << "whenAny idx=" << idx;
+        ok = ok && idx == 1;
+
+        auto bad = ep->scheduleWithResult([]() -> std::string { throw std::runtime_error("boom"); });
+        try {
+            bad.get();
+            ok = false;
+        } catch(std::runtime_error& e) {
+            Log_Info(Root_Logger()) << "exception: " << e.what();
+        }
+        ep->stop();
+    }
+
+    {
+        // 单线程: 等待者若阻塞线程, 被等待的任务将永远得不到执行
+        sylar::EventPoller::Ptr ep(new sylar::EventPoller(1, false));
+        ep->start();
+        auto outer = ep->scheduleWithResult([ep]() {
+            auto inner = ep->scheduleWithResult([]() { return std::string("inner"); });
+            return inner.get() + " done";
+        });
+        Log_Info(Root_Logger()) << "nested: " << outer.get();
+        ok = ok && outer.get() == "inner done";
+        ep->stop();
+    }
+
+    {
+        // 重复设置: 在写入之前抛出, 已有的结果不被覆盖
+        sylar::Promise<std::string> p;
+        sylar::Future<std::string> f = p.getFuture();
+        p.setValue("first");
+        int threw = 0;
+        try {
+            p.setValue("second");
+        } catch(std::logic_error& e) {
+            ++threw;
+        }
+        try {
+            p.setException(std::make_exception_ptr(std::runtime_error("late")));
+        } catch(std::logic_error& e) {
+            ++threw;
+        }
+        Log_Info(Root_Logger()) << "double set threw=" << threw << " value=" << f.get();
+        ok = ok && threw == 2 && f.get() == "first";
+    }
+
+    {
+        // use_caller 的根线程在 run 之外等待结果: 阻塞线程, 由其他工作线程执行任务
+        sylar::EventPoller::Ptr ep(new sylar::EventPoller(3, true));
+        ep->start();
+        auto f = ep->scheduleWithResult([]() { return sylar::getThreadId(); });
+        int thread = f.get();
+        Log_Info(Root_Logger()) << "caller thread wait: " << thread;
+        ok = ok && thread != sylar::getThreadId();
+        ep->stop();
+    }
+
+    Log_Info(Root_Logger()) << (ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,84 @@
+#include "eventpoller/eventpoller.h"
+#include "socket/fdManager.h"
+#include "log/logger.h"
+
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <atomic>
+#include <new>
+
+// 多个工作线程下带 SO_RCVTIMEO 的阻塞读: 唤醒后常在另一个线程上撤销超时, 撤销不应再分配内存。
+// 两个协程经两对 socketpair 来回传一个字节, 统计预热之后每轮(一次等待与唤醒)的 operator new 次数
+
+static std::atomic<uint64_t> s_news = {0};
+
+void* operator new(size_t size) {
+    s_news.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if(!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+static const int WARMUP = 1000;
+static const int ROUNDS = 20000;
+
+int main() {
+    Name_Logger("system")->setLevel(sylar::LogLevel::ERROR);
+    sylar::EventPoller::Ptr ep(new sylar::EventPoller(4, false, "io_timeout_alloc", sylar::EventPoller::EPOLL));
+
+    int ping[2], pong[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, ping);
+    socketpair(AF_UNIX, SOCK_STREAM, 0, pong);
+    timeval tv = {10, 0};
+    for(int fd : {ping[0], ping[1], pong[0], pong[1]}) {
+        sylar::FdMgr::getInstance()->get(fd, true);
+    }
+
+    std::atomic<uint64_t> start_news = {0};
+    std::atomic<bool> ok = {true};
+    auto echo = ep->scheduleWithResult([&]() {
+        setsockopt(ping[1], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        char c;
+        for(int i = 0; i < WARMUP + ROUNDS; ++i) {
+            if(recv(ping[1], &c, 1, 0) != 1 || send(pong[1], &c, 1, 0) != 1) {
+                ok = false;
+                return;
+            }
+        }
+    });
+    auto drive = ep->scheduleWithResult([&]() {
+        setsockopt(pong[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        char c = 'x';
+        for(int i = 0; i < WARMUP + ROUNDS; ++i) {
+            if(i == WARMUP) {
+                start_news = s_news.load();
+            }
+            if(send(ping[0], &c, 1, 0) != 1 || recv(pong[0], &c, 1, 0) != 1) {
+                ok = false;
+                return;
+            }
+        }
+    });
+    drive.get();
+    uint64_t news = s_news.load() - start_news;
+    echo.get();
+    ep->stop();
+
+    // 每轮两次阻塞读; 剩下的分配来自唤醒时调度器的任务节点
+    double per_wait = (double)news / (ROUNDS * 2);
+    bool pass = ok && per_wait <= 1.5;
+    Log_Info(Root_Logger()) << "operator new per wait/wake: " << per_wait << (pass ? " PASS" : " FAIL");
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,41 @@
+#include "eventpoller/eventpoller.h"
+#include "log/logger.h"
+
+#include <atomic>
+#include <thread>
+
+// 绑定线程的任务必须在指定线程上执行
+static const int PINNED = 100000;
+
+static std::atomic<int> s_done {0};
+static std::atomic<int> s_wrong {0};
+
+void pinned(int tid) {
+    if(sylar::getThreadId() != tid) {
+        ++s_wrong;
+    }
+    ++s_done;
+}
+
+void producer() {
+    int tid = sylar::getThreadId();
+    auto sc = sylar::Scheduler::getThis();
+    for(int i = 0; i < PINNED; ++i) {
+        sc->schedule(std::bind(&pinned, tid), tid);
+    }
+}
+
+int main() {
+    Name_Logger("system")->setLevel(sylar::LogLevel::ERROR);
+    {
+        sylar::EventPoller ep(4, false, "pin");
+        for(int i = 0; i < 4; ++i) {
+            ep.schedule(&producer);
+        }
+        while(s_done < 4 * PINNED) {
+            std::this_thread::yield();
+        }
+    }
+    Log_Info(Root_Logger()) << "pinned tasks: " << s_done << " on wrong thread: " << s_wrong;
+    return s_wrong == 0 ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+#include "eventpoller/eventpoller.h"
+#include "config/config.h"
+#include "log/logger.h"
+
+#include <signal.h>
+#include <unistd.h>
+#include <string>
+
+// addSignalHandler: 信号经 signalfd 送达, 回调作为任务在工作线程中运行; epoll 与 io_uring 两种后端,
+// 以及 use_caller 下由根线程登记、每线程 Loop 模式下在 stop 之前送达、工作线程中登记
+
+static bool RunChecks(sylar::EventPoller::Backend backend, bool use_caller = false, bool per_thread = false) {
+    sylar::Config::Lookup<bool>("eventpoller.per_thread_loop")->setValue(per_thread);
+    sylar::EventPoller::Ptr ep(new sylar::EventPoller(use_caller ? 3 : 2, use_caller, "signal", backend));
+    std::string name = ep->getBackend() == sylar::EventPoller::IO_URING ? "io_uring" : "epoll";
+    name += use_caller ? "/use_caller" : "";
+    name += per_thread ? "/per_thread" : "";
+
+    sylar::Promise<int> fired;
+    sylar::Future<int> done = fired.getFuture();
+    auto p = std::make_shared<sylar::Promise<int> >(std::move(fired));
+    bool ok = ep->addSignalHandler(SIGUSR1, [p]() {
+        p->setValue(sylar::getThreadId());
+    });
+    // 替换同一信号的回调, 并登记第二个信号
+    std::atomic<int> hups = {0};
+    ok = ep->addSignalHandler(SIGHUP, []() {}) && ok;
+    ok = ep->addSignalHandler(SIGHUP, [&hups]() { ++hups; }) && ok;
+
+    kill(getpid(), SIGHUP);
+    kill(getpid(), SIGUSR1);
+    int thread = done.get();
+    ok = ok && thread != sylar::getThreadId();
+
+    uint64_t start = sylar::getCurrentMS();
+    while(hups == 0 && sylar::getCurrentMS() - start < 1000) {
+        usleep(1000);
+    }
+    ok = ok && hups == 1;
+
+    ep->stop();
+    Log_Info(Root_Logger()) << name << (ok ? " PASS" : " FAIL");
+    return ok;
+}
+
+// 两个工作线程同时登记: 都不阻塞等待对方。默认处理为忽略的信号在屏蔽生效前到达时会丢失, 所以反复发送
+static bool RunWorkerChecks(sylar::EventPoller::Backend backend) {
+    sylar::Config::Lookup<bool>("eventpoller.per_thread_loop")->setValue(false);
+    sylar::EventPoller::Ptr ep(new sylar::EventPoller(2, false, "signal", backend));
+    std::string name = ep->getBackend() == sylar::EventPoller::IO_URING ? "io_uring" : "epoll";
+    name += "/worker";
+
+    // 发送信号的主线程不是工作线程, 按约定自行屏蔽
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGWINCH);
+    sigaddset(&mask, SIGURG);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+    std::atomic<int> winch = {0};
+    std::atomic<int> urg = {0};
+    auto a = ep->scheduleWithResult([&ep, &winch]() {
+        return ep->addSignalHandler(SIGWINCH, [&winch]() { ++winch; });
+    });
+    auto b = ep->scheduleWithResult([&ep, &urg]() {
+        return ep->addSignalHandler(SIGURG, [&urg]() { ++urg; });
+    });
+    bool ok = a.get() && b.get();
+
+    uint64_t start = sylar::getCurrentMS();
+    while((winch == 0 || urg == 0) && sylar::getCurrentMS() - start < 2000) {
+        kill(getpid(), SIGWINCH);
+        kill(getpid(), SIGURG);
+        usleep(10 * 1000);
+    }
+    ok = ok && winch > 0 && urg > 0;
+
+    ep->stop();
+    Log_Info(Root_Logger()) << name << (ok ? " PASS" : " FAIL");
+    return ok;
+}
+
+int main() {
+    Name_Logger("system")->setLevel(sylar::LogLevel::ERROR);
+    bool ok = RunChecks(sylar::EventPoller::EPOLL);
+    ok = RunChecks(sylar::EventPoller::IO_URING) && ok;
+    ok = RunChecks(sylar::EventPoller::EPOLL, true) && ok;
+    ok = RunChecks(sylar::EventPoller::EPOLL, true, true) && ok;
+    ok = RunChecks(sylar::EventPoller::IO_URING, true) && ok;
+    ok = RunWorkerChecks(sylar::EventPoller::EPOLL) && ok;
+    ok = RunWorkerChecks(sylar::EventPoller::IO_URING) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,38 @@
+#include "eventpoller/eventpoller.h"
+#include "config/config.h"
+#include "log/logger.h"
+
+#include <string.h>
+
+// 开启栈水位测量, 不同入口使用不同深度的栈, 检查按入口汇总的结果
+
+template<size_t N>
+static void UseStack() {
+    volatile char buf[N];
+    memset((char*)buf, 1, N);
+    buf[0] = buf[N - 1];
+}
+
+int main() {
+    Name_Logger("system")->setLevel(sylar::LogLevel::ERROR);
+    sylar::Config::Lookup<bool>("fiber.stack_watermark")->setValue(true);
+
+    sylar::EventPoller::Ptr ep(new sylar::EventPoller(2, false));
+    ep->start();
+    for(int i = 0; i < 100; ++i) {
+        ep->schedule([]() { UseStack<1024>(); });
+        ep->schedule([]() { UseStack<16 * 1024>(); });
+        ep->schedule([]() { UseStack<64 * 1024>(); });
+    }
+    ep->stop();
+
+    auto usage = ep->getStackUsage();
+    Log_Info(Root_Logger()) << ep->dumpStackUsage();
+
+    bool ok = usage.size() == 3;
+    for(auto& i : usage) {
+        ok = ok && i.count == 100;
+        ok = ok && i.max > 1024 && i.max < 128 * 1024;
+    }
+    return ok ? 0 : 1;
+}
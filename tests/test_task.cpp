@@ -0,0 +1,82 @@
+#include "fiber/task.h"
+#include "log/logger.h"
+
+#include <string>
+
+#ifdef SYLAR_HAVE_TASK
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// 无栈协程: 等待 fd 就绪、co_await 子任务与 Future, 以及 Fiber 代码等待协程结果
+
+static sylar::CoTask<int> Square(int v) {
+    co_return v * v;
+}
+
+static sylar::CoTask<std::string> Reader(int fd) {
+    int sq = co_await Square(7);
+    char buf[64];
+    std::string data;
+    while(true) {
+        ssize_t n = co_await sylar::AsyncRecv(fd, buf, sizeof(buf));
+        if(n <= 0) {
+            break;
+        }
+        data.append(buf, n);
+    }
+    co_return data + " " + std::to_string(sq);
+}
+
+static sylar::CoTask<int> AwaitFuture(sylar::EventPoller* ep) {
+    int v = co_await ep->scheduleWithResult([]() {
+        // 普通 Fiber 代码, 可以使用被 hook 的阻塞调用
+        usleep(1000);
+        return 42;
+    });
+    co_return v;
+}
+
+int main() {
+    Name_Logger("system")->setLevel(sylar::LogLevel::ERROR);
+    bool ok = true;
+
+    sylar::EventPoller::Ptr ep(new sylar::EventPoller(2, false));
+    ep->start();
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+    auto reader = sylar::Spawn<std::string>(ep.get(), Reader(fds[0]));
+    ep->schedule([fds]() {
+        const char* parts[] = {"hello", " ", "task"};
+        for(auto p : parts) {
+            usleep(10 * 1000);
+            write(fds[1], p, strlen(p));
+        }
+        close(fds[1]);
+    });
+    std::string got = reader.get();
+    Log_Info(Root_Logger()) << "reader: " << got;
+    ok = ok && got == "hello task 49";
+
+    int v = sylar::Spawn<int>(ep.get(), AwaitFuture(ep.get())).get();
+    Log_Info(Root_Logger()) << "future: " << v;
+    ok = ok && v == 42;
+
+    ep->stop();
+    close(fds[0]);
+    Log_Info(Root_Logger()) << (ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+#else
+
+int main() {
+    Log_Info(Root_Logger()) << "coroutine CoTask needs C++20 (SYLAR_COROUTINE), skipped";
+    return 0;
+}
+
+#endif
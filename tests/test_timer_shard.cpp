@@ -0,0 +1,79 @@
+#include "eventpoller/eventpoller.h"
+#include "config/config.h"
+#include "log/logger.h"
+
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+// 定时器分片: 工作线程上添加的定时器挂在本线程的分片上; 外部线程的添加、取消经投递生效; 周期定时器可跨线程取消
+
+static bool RunChecks(sylar::EventPoller::Backend backend, bool per_thread) {
+    sylar::Config::Lookup<bool>("eventpoller.per_thread_loop")->setValue(per_thread);
+    sylar::EventPoller::Ptr ep(new sylar::EventPoller(3, false, "timer_shard", backend));
+    std::string name = ep->getBackend() == sylar::EventPoller::IO_URING ? "io_uring" : "epoll";
+    name += per_thread ? "/per_thread" : "/shared";
+    bool ok = true;
+
+    // 1. 工作线程上添加
+    const int N = 64;
+    std::atomic<int> fired = {0};
+    for(int i = 0; i < N; ++i) {
+        ep->schedule([&ep, &fired, i]() {
+            ep->addTimer(i % 20, [&fired]() { ++fired; });
+        });
+    }
+
+    // 2. 外部线程添加, 其中一半随即取消
+    std::atomic<int> foreign = {0};
+    std::vector<sylar::Timer::Ptr> timers;
+    for(int i = 0; i < N; ++i) {
+        timers.push_back(ep->addTimer(10 + i % 10, [&foreign]() { ++foreign; }));
+    }
+    int cancelled = 0;
+    for(int i = 0; i < N; i += 2) {
+        cancelled += timers[i]->cancel();
+    }
+
+    // 3. 工作线程上的周期定时器, 由外部线程取消
+    std::atomic<int> ticks = {0};
+    sylar::Promise<sylar::Timer::Ptr> created;
+    sylar::Future<sylar::Timer::Ptr> recurring = created.getFuture();
+    auto p = std::make_shared<sylar::Promise<sylar::Timer::Ptr> >(std::move(created));
+    ep->schedule([&ep, &ticks, p]() {
+        p->setValue(ep->addTimer(5, [&ticks]() { ++ticks; }, true));
+    });
+    sylar::Timer::Ptr tick_timer = recurring.get();
+
+    uint64_t start = sylar::getCurrentMS();
+    while((fired < N || foreign < N - cancelled || ticks < 5) && sylar::getCurrentMS() - start < 2000) {
+        usleep(1000);
+    }
+    ok = ok && tick_timer->cancel();
+    // 取消之前已取出的回调仍会执行一次
+    usleep(20 * 1000);
+    int stopped_at = ticks;
+    usleep(50 * 1000);
+
+    ok = ok && fired == N;
+    ok = ok && cancelled == N / 2 && foreign == N / 2;
+    ok = ok && stopped_at >= 5 && ticks == stopped_at;
+    ok = ok && !ep->hasTimer();
+    if(!ok) {
+        Log_Error(Root_Logger()) << name << " fired=" << fired
+            << " cancelled=" << cancelled << " foreign=" << foreign
+            << " ticks=" << ticks << "/" << stopped_at << " has=" << ep->hasTimer();
+    }
+
+    ep->stop();
+    Log_Info(Root_Logger()) << name << (ok ? " PASS" : " FAIL");
+    return ok;
+}
+
+int main() {
+    Name_Logger("system")->setLevel(sylar::LogLevel::ERROR);
+    bool ok = RunChecks(sylar::EventPoller::EPOLL, false);
+    ok = RunChecks(sylar::EventPoller::EPOLL, true) && ok;
+    ok = RunChecks(sylar::EventPoller::IO_URING, false) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,44 @@
+#include "eventpoller/eventpoller.h"
+#include "util/hook.h"
+#include "log/logger.h"
+
+#include <algorithm>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+// 钩子层的 usleep/nanosleep 按微秒定时: 工作线程上 200us 的睡眠不能被取整到毫秒
+
+static const uint64_t SLEEP_US = 200;
+static const int ROUNDS = 21;
+
+int main() {
+    Name_Logger("system")->setLevel(sylar::LogLevel::ERROR);
+    sylar::EventPoller::Ptr ep(new sylar::EventPoller(2, false, "usleep"));
+
+    auto result = ep->scheduleWithResult([]() {
+        std::vector<uint64_t> used;
+        for(int i = 0; i < ROUNDS; ++i) {
+            uint64_t start = sylar::getTimeUsec();
+            if(i % 2) {
+                usleep(SLEEP_US);
+            } else {
+                timespec ts = {0, (long)SLEEP_US * 1000};
+                nanosleep(&ts, nullptr);
+            }
+            used.push_back(sylar::getTimeUsec() - start);
+        }
+        std::sort(used.begin(), used.end());
+        return used;
+    });
+    std::vector<uint64_t> used = result.get();
+    ep->stop();
+
+    // 不能早于请求的时长; 取中位数, 避开偶发的调度延迟
+    uint64_t median = used[ROUNDS / 2];
+    bool ok = used.front() >= SLEEP_US && median < 1000;
+    Log_Info(Root_Logger()) << "sleep " << SLEEP_US << "us: min=" << used.front()
+        << "us median=" << median << "us max=" << used.back() << "us"
+        << (ok ? " PASS" : " FAIL");
+    return ok ? 0 : 1;
+}